@@ -96,7 +96,7 @@ build_binary() {
   [[ -f "${SRC_LODE}" && -f "${HDR_LODE}" ]] || die "lodepng.c/h not found in repo"
   [[ -f "${HDR_STBI}" && -f "${HDR_STBT}" ]] || die "stb headers not found in repo"
   say "Building ${BIN_NAME}"
-  local cmd=(gcc -O2 -Wall "${SRC_MAIN}" "${SRC_LODE}" -lusb-1.0 -lm -o "${REPO_DIR}/${BIN_NAME}")
+  local cmd=(gcc -O2 -Wall "${SRC_MAIN}" "${SRC_LODE}" -lusb-1.0 -lm -pthread -o "${REPO_DIR}/${BIN_NAME}")
   echo "    ${cmd[*]}"
   if [[ "${DRY_RUN}" != "yes" ]]; then
     "${cmd[@]}"
@@ -142,6 +142,7 @@ After=default.target
 Type=simple
 WorkingDirectory=${work}
 ExecStart=${exec}
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=always
 RestartSec=2
 Nice=10
@@ -205,6 +206,7 @@ After=multi-user.target
 Type=simple
 WorkingDirectory=${confdir}
 ExecStart=${bindir}/${BIN_NAME}
+ExecReload=/bin/kill -HUP \$MAINPID
 Restart=always
 RestartSec=2
 Nice=10
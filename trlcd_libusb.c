@@ -3,7 +3,7 @@
 // correct blend/dispose and timed playback.
 //
 // Build:
-//   gcc -O2 -Wall trlcd_libusb.c lodepng.c -lusb-1.0 -lm -o trlcd_libusb
+//   gcc -O2 -Wall trlcd_libusb.c lodepng.c -lusb-1.0 -lm -pthread -o trlcd_libusb
 //
 // Requires (in same directory):
 //   - stb_image.h        (PNG decode for static images)
@@ -14,6 +14,16 @@
 //   * Background offset can be numeric or "center" (layout.cfg)
 //   * Text is TTF-only; bitmap font removed.
 //   * Tokens: %CPU_TEMP% %CPU_USAGE% %MEM_USED% %MEM_FREE% %GPU_TEMP% %GPU_USAGE% %TIME% %DATE%
+//   * visible_if=<expr> on layers and [page] groups with timed rotation/alerts.
+//   * Assets decode lazily on a loader thread; memory_budget_mb bounds them (LRU)
+//     and picks raw/rle/stream storage. SIGUSR1 prints a memory report.
+//   * wire_format=jpeg sends JPEG frames (fmt from wire_format=probe).
+//   * The layout is compiled into a display list; SIGHUP reloads it in place.
+//   * --analyze reports per-layer cost and memory from a headless run.
+//   * stats_path=<file.prom> exports counters for node_exporter's textfile collector.
+//   * Frames go out on a transmit thread (tx_sched/tx_cpu/tx_mlock tune only it).
+//   * Sensor files stay open; metrics_io=uring batches a sample into one syscall.
+//   * USDT probes (provider trlcd); trace_frames= / SIGUSR2 write a Chrome trace.
 
 #define _GNU_SOURCE
 #define _POSIX_C_SOURCE 200809L
@@ -28,22 +38,67 @@
 #include <time.h>
 #include <dirent.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <limits.h>
 
 #include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#if defined(__has_include) && !defined(TRLCD_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRLCD_USDT 1
+#endif
+#endif
+#if defined(__has_include) && !defined(TRLCD_NO_URING)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define TRLCD_URING 1
+#endif
+#endif
+#endif
 
 static volatile sig_atomic_t g_reload = 0;
 static volatile sig_atomic_t g_stop   = 0;
+static volatile sig_atomic_t g_mem_report = 0;
+static volatile sig_atomic_t g_trace_req = 0;
 
 static void on_sighup(int sig){ (void)sig; g_reload = 1; }
 static void on_sigterm(int sig){ (void)sig; g_stop = 1; }
+static void on_sigusr1(int sig){ (void)sig; g_mem_report = 1; }
+static void on_sigusr2(int sig){ (void)sig; g_trace_req = 1; }
 
-// Panel params
-#define VID 0x0416
-#define PID 0x5302
-#define W   240
-#define H   320
-#define PACK 512
+// Panel params ---------------------------------------------------------------------
+// Picked at startup from g_profiles (or a custom one from layout.cfg). W/H/PACK
+// keep their old names but read the active profile.
+typedef enum { PIX_RGB565=2 } PixFmt; // raw pixel formats, valued as the header fmt byte
+typedef struct {
+    const char *name;
+    uint16_t vid, pid;
+    int w, h;               // frame as sent: h rows of w pixels
+    PixFmt pix;             // raw frame format (only RGB565 is packed; FRAME_LEN assumes it)
+    int packet;             // OUT transfer size, header included
+    uint8_t ver, cmd;       // header template
+    uint8_t extra[4];       // header bytes 26..29
+} DeviceProfile;
+static const DeviceProfile g_profiles[]={
+    { "trlcd-240x320", 0x0416, 0x5302, 240, 320, PIX_RGB565, 512, 0x02, 0x01, {0x00,0x00,0x00,0x08} },
+};
+#define N_PROFILES ((int)(sizeof g_profiles/sizeof g_profiles[0]))
+static DeviceProfile g_dev;
+#define VID (g_dev.vid)
+#define PID (g_dev.pid)
+#define W   (g_dev.w)
+#define H   (g_dev.h)
+#define PACK (g_dev.packet)
+#define PACK_MAX 1024       // upper bound for packet buffers
 #define FRAME_LEN (W*H*2)
 #define CL_TIMEOUT 1000
 
@@ -101,6 +156,114 @@ static uint64_t now_monotonic_ms(void){
     struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
     return (uint64_t)ts.tv_sec*1000ull + (uint64_t)ts.tv_nsec/1000000ull;
 }
+
+// Startup timeline (debug=1): milestones relative to process start, until the
+// first frame with every visible asset ready has been sent.
+static uint64_t g_start_us; static volatile sig_atomic_t g_timeline;
+static uint64_t now_monotonic_us(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000ull + (uint64_t)ts.tv_nsec/1000ull;
+}
+static void startup_begin(void){
+    g_start_us=now_monotonic_us();
+}
+static void startup_mark(const char *fmt, ...){
+    if(!g_timeline) return;
+    char msg[256]; va_list ap; va_start(ap,fmt); vsnprintf(msg,sizeof msg,fmt,ap); va_end(ap);
+    uint64_t us=now_monotonic_us()-g_start_us;
+    fprintf(stderr,"[startup] +%4llu.%llums %s\n",(unsigned long long)(us/1000),(unsigned long long)(us%1000/100),msg);
+}
+
+// Tracing ------------------------------------------------------------------------
+// Static probes (USDT, provider "trlcd") when <sys/sdt.h> is there at build
+// time; -DTRLCD_NO_USDT leaves them out. Unattached they are a nop.
+//   frame_begin(frame)  frame_end(frame, payload bytes)  stage(stage, us)
+//   layer_begin(op, kind)  layer_end(op, kind)
+//   usb_submit(len, attempt)  usb_complete(rc, transferred, attempt)
+//   usb_recover(action 0=clear halt 1=reset 2=reopen, attempt)
+//   asset_begin(path)  asset_end(path, state)
+// e.g. bpftrace -e 'usdt:./trlcd_libusb:trlcd:usb_recover { @[arg0]=count(); }'
+#ifdef TRLCD_USDT
+#define PROBE1(n,a)     DTRACE_PROBE1(trlcd,n,a)
+#define PROBE2(n,a,b)   DTRACE_PROBE2(trlcd,n,a,b)
+#define PROBE3(n,a,b,c) DTRACE_PROBE3(trlcd,n,a,b,c)
+#else
+#define PROBE1(n,a)     do{}while(0)
+#define PROBE2(n,a,b)   do{}while(0)
+#define PROBE3(n,a,b,c) do{}while(0)
+#endif
+
+// Chrome trace recorder: trace_frames=N records spans for the next N frames
+// (from startup, and again on SIGUSR2) and writes them to trace_path as
+// trace-event JSON for chrome://tracing or Perfetto. Spans come from the render
+// thread (frame, stages, layers), the transmit thread (send, USB packets and
+// recovery) and the loader thread (asset decode/evict), so their overlap shows
+// on one timeline.
+enum { TID_RENDER=1, TID_LOADER=2, TID_TX=3 };
+typedef struct { const char *cat, *name; uint64_t ts, dur; int tid; long arg; char detail[56]; } TraceEv;
+#define TRACE_MAX_EVENTS 500000
+static struct {
+    pthread_mutex_t mu;
+    int on; int frames_left, dropped;   // on: read unlocked via TRACE_ON()
+    TraceEv *ev; size_t n, cap;
+} g_trace = { PTHREAD_MUTEX_INITIALIZER };
+#define TRACE_ON() __atomic_load_n(&g_trace.on,__ATOMIC_RELAXED)
+
+static void trace_start(int frames){
+    pthread_mutex_lock(&g_trace.mu);
+    g_trace.n=0; g_trace.dropped=0; g_trace.frames_left=frames; __atomic_store_n(&g_trace.on,frames>0,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_trace.mu);
+}
+// Span from ts to now (us)
+static void trace_span(int tid, const char *cat, const char *name, uint64_t ts, long arg, const char *detail){
+    if(!TRACE_ON()) return;
+    uint64_t now=now_monotonic_us();
+    pthread_mutex_lock(&g_trace.mu);
+    if(g_trace.on){
+        if(g_trace.n==g_trace.cap && g_trace.cap<TRACE_MAX_EVENTS){
+            g_trace.cap=g_trace.cap?g_trace.cap*2:4096;
+            g_trace.ev=(TraceEv*)realloc(g_trace.ev,g_trace.cap*sizeof(TraceEv)); if(!g_trace.ev) die("realloc trace");
+        }
+        if(g_trace.n<g_trace.cap){
+            TraceEv *e=&g_trace.ev[g_trace.n++];
+            e->cat=cat; e->name=name; e->ts=ts; e->dur=now-ts; e->tid=tid; e->arg=arg; e->detail[0]=0;
+            if(detail){ size_t l=strlen(detail); strcpy(e->detail, l<sizeof e->detail? detail : detail+l-(sizeof e->detail-1)); }
+        } else g_trace.dropped++;
+    }
+    pthread_mutex_unlock(&g_trace.mu);
+}
+static void json_str(FILE *f, const char *s){
+    fputc('"',f);
+    for(;*s;s++){ unsigned char c=(unsigned char)*s;
+        if(c=='"'||c=='\\') fprintf(f,"\\%c",c); else if(c<0x20) fprintf(f,"\\u%04x",c); else fputc(c,f); }
+    fputc('"',f);
+}
+// Stops recording and writes the JSON (<path>.tmp + rename)
+static int trace_write(const char *path){
+    pthread_mutex_lock(&g_trace.mu); __atomic_store_n(&g_trace.on,0,__ATOMIC_RELAXED); pthread_mutex_unlock(&g_trace.mu);
+    char tmp[600]; snprintf(tmp,sizeof tmp,"%s.tmp",path);
+    FILE *f=fopen(tmp,"w");
+    if(!f){ fprintf(stderr,"trace %s: %s\n", tmp, strerror(errno)); return -1; }
+    fprintf(f,"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"render\"}},\n", TID_RENDER);
+    fprintf(f,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"loader\"}},\n", TID_LOADER);
+    fprintf(f,"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"usb tx\"}}", TID_TX);
+    for(size_t i=0;i<g_trace.n;i++){
+        const TraceEv *e=&g_trace.ev[i];
+        fprintf(f,",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"n\":%ld",
+                e->name, e->cat, e->tid, (unsigned long long)(e->ts-g_start_us), (unsigned long long)e->dur, e->arg);
+        if(e->detail[0]){ fprintf(f,",\"detail\":"); json_str(f,e->detail); }
+        fprintf(f,"}}");
+    }
+    fprintf(f,"\n]}\n");
+    int rc = ferror(f)? -1 : 0;
+    if(fclose(f)!=0) rc=-1;
+    if(!rc && rename(tmp,path)!=0) rc=-1;
+    if(rc){ fprintf(stderr,"trace %s: %s\n", path, strerror(errno)); unlink(tmp); return -1; }
+    fprintf(stderr,"[trace] %zu events written to %s%s\n", g_trace.n, path, g_trace.dropped? " (buffer full, later events dropped)" : "");
+    return 0;
+}
+
 static void trim(char *s){
     int n=(int)strlen(s);
     while(n>0 && (s[n-1]=='\r'||s[n-1]=='\n'||isspace((unsigned char)s[n-1]))) s[--n]=0;
@@ -109,7 +272,19 @@ static void trim(char *s){
 }
 
 // Layout & Config ----------------------------------------------------------------
-typedef struct { int x,y,w,h; uint8_t r,g,b,a; } Overlay;
+typedef struct {
+    int x,y,w,h; uint8_t r,g,b,a;
+    int page;                   // -1 all pages, else index into Layout.pages
+    char *visible_if;           // optional condition (NULL = always)
+    double update_hz;           // re-evaluated this often (0 = every frame)
+    // Shapes (any of these set: rendered once into a sprite)
+    int shape;                  // 0 rect, 1 ellipse
+    int radius, border;         // corner radius, border width
+    uint8_t br,bg,bb,ba;        // border colour
+    int gradient;               // 0 none, 1 linear, 2 radial: color -> color2
+    uint8_t r2,g2,b2,a2;
+    float angle;                // linear: degrees, 0 = left to right, 90 = top to bottom
+} Overlay;
 
 typedef enum { ORIENT_PORTRAIT=0, ORIENT_LANDSCAPE=1 } UiOrient;
 
@@ -124,8 +299,24 @@ typedef struct {
 
     char *ttf_path;
     int   ttf_px;
+
+    int   page;                 // -1 all pages, else index into Layout.pages
+    char *visible_if;           // optional condition (NULL = always)
+    double update_hz;           // tokens/conditions re-evaluated this often (0 = every frame)
+
+    float scroll;               // marquee speed in px/s (0 = static)
+    int   scroll_w, scroll_gap; // window width (0 = to the layout edge), gap between repeats
+
+    int   box_w, box_h;         // text box: wrap width and clip height (0 = none)
+    int   max_lines;            // 0 = as many as fit
+    int   align;                // 0 left, 1 center, 2 right (within box_w)
+    char *ellipsis;             // marks cut text (NULL = "…")
 } TextItem;
 
+// Rotation of an [image]: value v0..v1 maps onto a0..a1 degrees clockwise,
+// quantized to step; pivot in sprite pixels (NaN = centre)
+typedef struct { double v0, v1, a0, a1, step; float pvx, pvy; int cache; } RotSpec;
+
 typedef struct {
     char *path;
     int x,y;
@@ -136,8 +327,27 @@ typedef struct {
     int64_t apng_start_ms; // 0
     int apng_loop_mode; // 0=default(file) 1=infinite 2=once 3=customN
     int apng_loop_N;
+    int apng_resample;  // -1 = global apng_resample=, else 0 off, 1 nearest, 2 blend
+    int page;           // -1 all pages, else index into Layout.pages
+    char *visible_if;   // optional condition (NULL = always)
+    double update_hz;   // frame/value/condition re-evaluated this often (0 = every frame)
+    int storage;        // AssetStore: 0 auto, 1 raw, 2 rle, 3 stream
+    char *frame_from;   // APNG frame picked by this metric/expression instead of time (NULL = time)
+    double frame_min, frame_max; // value range mapped onto the first..last frame
+    char *rotate_from;  // turned by this metric/expression (NULL = not rotated)
+    RotSpec rot;
 } ImgLayer;
 
+typedef struct {
+    char name[64];
+    int  duration_ms;   // time on screen before rotating to the next page
+    char *visible_if;   // page only eligible while true (NULL = always)
+    int  alert;         // eligible alert pages preempt the rotation
+    int  transition, transition_ms; // into this page; -1 = the global ones
+} Page;
+
+typedef enum { WIRE_RGB565=0, WIRE_JPEG, WIRE_PROBE } WireFormat;
+
 typedef struct {
     // Background
     char background_png[512];
@@ -160,11 +370,41 @@ typedef struct {
     int fps;
     int once;
     int iface;
+    char snapshot_path[512];    // last sent frame, pushed first on startup ("" = off)
+    int snapshot_interval_s;    // how often it is rewritten while running
+    int snapshot_hold_ms;       // startup snapshot stays up this long while assets load
+    char stats_path[512];       // Prometheus textfile (.prom) with counters ("" = off)
+    int stats_interval_s;       // how often it is rewritten
+    char trace_path[512];       // Chrome trace-event JSON
+    int trace_frames;           // frames recorded from startup / per SIGUSR2 (0 = only on SIGUSR2, 120)
+    int metrics_uring;          // metrics_io=uring: one io_uring batch per sample (else pread)
+
+    // USB transmit thread (the render thread keeps default scheduling)
+    int tx_sched;               // 0 other, 1 fifo, 2 rr
+    int tx_priority;            // SCHED_FIFO/RR priority 1..99
+    int tx_nice;                // nice for tx_sched=other (-20..19; 99 = inherit)
+    int tx_cpu;                 // pin to this CPU (-1 = any)
+    int tx_mlock;               // lock its stack and frame buffers in RAM
+
+    // Device profile
+    char device[64];            // "auto" or a g_profiles name
+    int dev_vid, dev_pid;       // custom profile (0 = not set)
+    int dev_w, dev_h, dev_packet;
+
+    // Wire format
+    WireFormat wire_format;
+    int wire_fmt;               // header fmt byte for JPEG frames (-1 = not set)
+    int jpeg_quality;           // 1..100
+    char wire_probe_fmts[128];  // fmt values tried by wire_format=probe
+    int wire_probe_hold_ms;     // how long each probe card stays up
 
     // Objects
     Overlay  *overlays; int n_overlays;
     TextItem *texts;    int n_texts;
     ImgLayer *imgs;     int n_imgs;
+    Page     *pages;    int n_pages;
+    int page_duration_ms;       // default rotation interval
+    int transition, transition_ms; // page switches and reloads: index into g_trans_names, duration
 
     // Global TTF default
     char default_ttf[512];
@@ -175,15 +415,44 @@ typedef struct {
     int64_t bg_apng_start_ms;
     int bg_apng_loop_mode; // 0 default(file) 1 inf 2 once 3 customN
     int bg_apng_loop_N;
+    int apng_resample;      // 0 off, 1 nearest, 2 blend: APNGs resampled to fps at load (background, [image] default)
+    double bg_update_hz;    // background_update_hz: APNG frame picked this often (0 = every frame)
+    int bg_fill;            // 0 none (black), 1 background_color, 2/3 background_gradient vertical/horizontal
+    uint8_t bg_c0[3], bg_c1[3];
+
+    // Assets
+    int memory_budget_mb;       // 0 = unlimited; picks storage and LRU-evicts above this
+    int bg_storage;             // AssetStore for the background
+    uint8_t placeholder_r, placeholder_g, placeholder_b, placeholder_a; // drawn while an image loads
 
     // Debug
     int debug;
 } Layout;
 
+typedef enum { STORE_AUTO=0, STORE_RAW, STORE_RLE, STORE_STREAM } AssetStore;
+static const char *store_name(AssetStore s){ return s==STORE_RAW?"raw":s==STORE_RLE?"rle":s==STORE_STREAM?"stream":"auto"; }
+static int parse_store(const char *v, int *out){
+    if(!strcasecmp(v,"auto")) *out=STORE_AUTO; else if(!strcasecmp(v,"raw")) *out=STORE_RAW;
+    else if(!strcasecmp(v,"rle")||!strcasecmp(v,"compressed")) *out=STORE_RLE;
+    else if(!strcasecmp(v,"stream")||!strcasecmp(v,"streamed")) *out=STORE_STREAM;
+    else return -1;
+    return 0;
+}
 static UiOrient parse_orient(const char *v){
     if(v && strcasecmp(v,"landscape")==0) return ORIENT_LANDSCAPE;
     return ORIENT_PORTRAIT;
 }
+static const char *const g_trans_names[]={ "none", "fade", "slide_left", "slide_right", "slide_up", "slide_down",
+                                           "wipe_left", "wipe_right", "wipe_up", "wipe_down" };
+static int parse_transition(const char *v){
+    for(int i=0;i<(int)(sizeof g_trans_names/sizeof *g_trans_names);i++) if(!strcasecmp(v,g_trans_names[i])) return i;
+    fprintf(stderr,"transition must be none|fade|slide_left|slide_right|slide_up|slide_down|wipe_left|wipe_right|wipe_up|wipe_down\n");
+    return -1;
+}
+static int parse_resample(const char *v){
+    if(!strcasecmp(v,"off")) return 0; if(!strcasecmp(v,"nearest")) return 1; if(!strcasecmp(v,"blend")) return 2;
+    fprintf(stderr,"apng_resample must be off|nearest|blend\n"); return -1;
+}
 static int parse_rect(const char *s, int *x,int *y,int *w,int *h){
     int X=0,Y=0,Wd=0,Ht=0;
     int n = sscanf(s," %d , %d , %d , %d ",&X,&Y,&Wd,&Ht);
@@ -217,6 +486,14 @@ static void layout_init(Layout *L){
     L->viewport_x=-1; L->viewport_y=-1;
     L->default_ttf[0]=0; L->default_ttf_px=0;
     L->bg_apng_speed=1.0; L->bg_apng_start_ms=0; L->bg_apng_loop_mode=0; L->bg_apng_loop_N=0;
+    L->page_duration_ms=5000; L->transition_ms=300;
+    strcpy(L->snapshot_path,"last_frame.rgb565"); L->snapshot_interval_s=30; L->snapshot_hold_ms=5000;
+    L->stats_interval_s=15;
+    strcpy(L->trace_path,"trlcd_trace.json");
+    L->tx_priority=50; L->tx_nice=99; L->tx_cpu=-1;
+    strcpy(L->device,"auto");
+    L->wire_format=WIRE_RGB565; L->wire_fmt=-1; L->jpeg_quality=85;
+    strcpy(L->wire_probe_fmts,"1,3,4,5,6,7,8"); L->wire_probe_hold_ms=3000;
     L->debug=0;
 }
 static void add_overlay(Layout *L, Overlay ov){
@@ -231,32 +508,62 @@ static void add_img(Layout *L, ImgLayer im){
     L->imgs=(ImgLayer*)realloc(L->imgs,(L->n_imgs+1)*sizeof(ImgLayer));
     if(!L->imgs) die("realloc imgs"); L->imgs[L->n_imgs++]=im;
 }
+static void add_page(Layout *L, Page pg){
+    L->pages=(Page*)realloc(L->pages,(L->n_pages+1)*sizeof(Page));
+    if(!L->pages) die("realloc pages"); L->pages[L->n_pages++]=pg;
+}
+// "all"/"*" => -1 (every page), otherwise a page name declared earlier
+static int parse_page_ref(const Layout *L, const char *v, int *out){
+    if(!strcasecmp(v,"all")||!strcmp(v,"*")){ *out=-1; return 0; }
+    for(int i=0;i<L->n_pages;i++) if(!strcmp(L->pages[i].name,v)){ *out=i; return 0; }
+    return -1;
+}
+static void text_defaults(TextItem *t, int page){
+    memset(t,0,sizeof *t); t->a=255; t->orient_override=-1;
+    t->landscape_ccw_override=-1; t->flip_override=-1; t->page=page; t->scroll_gap=40;
+}
+static void img_defaults(ImgLayer *im, int page){
+    memset(im,0,sizeof *im); im->alpha=255; im->scale=1.0f;
+    im->apng_speed=1.0; im->apng_start_ms=0; im->apng_loop_mode=0; im->apng_loop_N=0; im->apng_resample=-1; im->page=page;
+    im->frame_min=0; im->frame_max=100;
+    im->rot=(RotSpec){ 0, 100, 0, 360, 1.0, NAN, NAN, 64 };
+}
+static void overlay_defaults(Overlay *ov, int page){ memset(ov,0,sizeof *ov); ov->page=page; }
 static int load_layout(const char *path, Layout *L){
     layout_init(L);
     FILE *f=fopen(path,"r"); if(!f){ perror("open layout.cfg"); return -1; }
-    enum { SEC_NONE, SEC_OVERLAY, SEC_TEXT, SEC_IMAGE } sec=SEC_NONE;
-    TextItem cur_text; memset(&cur_text,0,sizeof(cur_text));
-    cur_text.a=255; cur_text.orient_override=-1;
-    cur_text.landscape_ccw_override=-1; cur_text.flip_override=-1;
+    enum { SEC_NONE, SEC_OVERLAY, SEC_TEXT, SEC_IMAGE, SEC_PAGE } sec=SEC_NONE;
+    int cur_page=-1; // layers declared after a [page] header belong to it
+
+    TextItem cur_text; text_defaults(&cur_text,cur_page);
     int have_text=0;
 
-    ImgLayer cur_img; memset(&cur_img,0,sizeof cur_img);
-    cur_img.alpha=255; cur_img.scale=1.0f;
-    cur_img.apng_speed=1.0; cur_img.apng_start_ms=0; cur_img.apng_loop_mode=0; cur_img.apng_loop_N=0;
+    ImgLayer cur_img; img_defaults(&cur_img,cur_page);
     int have_img=0;
 
+    // Each rect= starts a new overlay; the pending one is committed on the next rect= or section end
+    Overlay cur_ov; overlay_defaults(&cur_ov,cur_page);
+    int have_ov=0;
+
     char line[1024];
     while(fgets(line,sizeof line,f)){
         trim(line); if(line[0]==0||line[0]=='#') continue;
         if(line[0]=='['){
-            if(sec==SEC_TEXT && have_text && cur_text.text){ add_text(L,cur_text); memset(&cur_text,0,sizeof cur_text);
-                cur_text.a=255; cur_text.orient_override=-1; cur_text.landscape_ccw_override=-1; cur_text.flip_override=-1; have_text=0; }
-            if(sec==SEC_IMAGE && have_img && cur_img.path){ add_img(L,cur_img); memset(&cur_img,0,sizeof cur_img);
-                cur_img.alpha=255; cur_img.scale=1.0f; cur_img.apng_speed=1.0; cur_img.apng_start_ms=0; cur_img.apng_loop_mode=0; cur_img.apng_loop_N=0; have_img=0; }
-            if(!strcmp(line,"[overlay]")) sec=SEC_OVERLAY;
+            if(sec==SEC_TEXT && have_text && cur_text.text){ add_text(L,cur_text); text_defaults(&cur_text,cur_page); have_text=0; }
+            if(sec==SEC_IMAGE && have_img && cur_img.path){ add_img(L,cur_img); img_defaults(&cur_img,cur_page); have_img=0; }
+            if(sec==SEC_OVERLAY && have_ov){ add_overlay(L,cur_ov); have_ov=0; }
+            if(!strcmp(line,"[page]")){
+                Page pg; memset(&pg,0,sizeof pg); pg.duration_ms=-1; pg.transition=pg.transition_ms=-1;
+                snprintf(pg.name,sizeof pg.name,"page%d",L->n_pages);
+                add_page(L,pg); cur_page=L->n_pages-1; sec=SEC_PAGE;
+            }
+            else if(!strcmp(line,"[overlay]")) sec=SEC_OVERLAY;
             else if(!strcmp(line,"[text]")) sec=SEC_TEXT;
             else if(!strcmp(line,"[image]")) sec=SEC_IMAGE;
             else sec=SEC_NONE;
+            // new sections start on the current page
+            cur_text.page=cur_page; cur_img.page=cur_page;
+            overlay_defaults(&cur_ov,cur_page);
             continue;
         }
         char *eq=strchr(line,'='); if(!eq) continue; *eq=0; char *k=line,*v=eq+1; trim(k); trim(v);
@@ -264,6 +571,15 @@ static int load_layout(const char *path, Layout *L){
         if(sec==SEC_NONE){
             if(!strcmp(k,"background_png")) { strncpy(L->background_png,v,sizeof(L->background_png)-1); }
             else if(!strcmp(k,"background_flip")) L->background_flip=atoi(v);
+            else if(!strcmp(k,"background_color")){ uint8_t a; if(parse_rgbA(v,&L->bg_c0[0],&L->bg_c0[1],&L->bg_c0[2],&a)!=0) fprintf(stderr,"Bad background_color\n"); else L->bg_fill=1; }
+            else if(!strcmp(k,"background_gradient")){
+                int c[6], ok; char dir[16]="";
+                int n=sscanf(v," %d , %d , %d , %d , %d , %d , %15s",&c[0],&c[1],&c[2],&c[3],&c[4],&c[5],dir);
+                ok = n>=6 && (n==6 || !strcasecmp(dir,"vertical") || !strcasecmp(dir,"horizontal"));
+                for(int i=0;i<6 && ok;i++) if(c[i]<0 || c[i]>255) ok=0;
+                if(!ok) fprintf(stderr,"background_gradient must be r,g,b,r,g,b[,vertical|horizontal]\n");
+                else { for(int i=0;i<3;i++){ L->bg_c0[i]=(uint8_t)c[i]; L->bg_c1[i]=(uint8_t)c[i+3]; } L->bg_fill = n==7 && !strcasecmp(dir,"horizontal")? 3 : 2; }
+            }
             else if(!strcmp(k,"background_x")){ if(strcasecmp(v,"center")==0)L->bg_x_mode=1; else{L->bg_x_mode=0; L->bg_x=atoi(v);} }
             else if(!strcmp(k,"background_y")){ if(strcasecmp(v,"center")==0)L->bg_y_mode=1; else{L->bg_y_mode=0; L->bg_y=atoi(v);} }
 
@@ -278,7 +594,50 @@ static int load_layout(const char *path, Layout *L){
             else if(!strcmp(k,"fps")) L->fps=atoi(v);
             else if(!strcmp(k,"once")) L->once=atoi(v);
             else if(!strcmp(k,"iface")) L->iface=atoi(v);
+            else if(!strcmp(k,"snapshot_path")) { L->snapshot_path[0]=0; strncat(L->snapshot_path,v,sizeof(L->snapshot_path)-1); }
+            else if(!strcmp(k,"snapshot_interval_s")) L->snapshot_interval_s=atoi(v);
+            else if(!strcmp(k,"snapshot_hold_ms")) L->snapshot_hold_ms=atoi(v);
+            else if(!strcmp(k,"stats_path")) { L->stats_path[0]=0; strncat(L->stats_path,v,sizeof(L->stats_path)-1); }
+            else if(!strcmp(k,"stats_interval_s")) L->stats_interval_s=atoi(v);
+            else if(!strcmp(k,"trace_path")) { L->trace_path[0]=0; strncat(L->trace_path,v,sizeof(L->trace_path)-1); }
+            else if(!strcmp(k,"trace_frames")) L->trace_frames=atoi(v);
+            else if(!strcmp(k,"tx_sched")){
+                if(!strcasecmp(v,"other")) L->tx_sched=0;
+                else if(!strcasecmp(v,"fifo")) L->tx_sched=1;
+                else if(!strcasecmp(v,"rr")) L->tx_sched=2;
+                else fprintf(stderr,"tx_sched must be other|fifo|rr\n");
+            }
+            else if(!strcmp(k,"tx_priority")) L->tx_priority=atoi(v);
+            else if(!strcmp(k,"tx_nice")) L->tx_nice=atoi(v);
+            else if(!strcmp(k,"tx_cpu")) L->tx_cpu=atoi(v);
+            else if(!strcmp(k,"tx_mlock")) L->tx_mlock=atoi(v);
+            else if(!strcmp(k,"metrics_io")){
+                if(!strcasecmp(v,"pread")) L->metrics_uring=0;
+                else if(!strcasecmp(v,"uring")) L->metrics_uring=1;
+                else fprintf(stderr,"metrics_io must be pread|uring\n");
+            }
+            else if(!strcmp(k,"device")) { L->device[0]=0; strncat(L->device,v,sizeof(L->device)-1); }
+            else if(!strcmp(k,"device_vid")) L->dev_vid=(int)strtol(v,NULL,16);
+            else if(!strcmp(k,"device_pid")) L->dev_pid=(int)strtol(v,NULL,16);
+            else if(!strcmp(k,"device_size")){ if(sscanf(v," %d x %d",&L->dev_w,&L->dev_h)!=2) fprintf(stderr,"device_size must be WxH\n"); }
+            else if(!strcmp(k,"device_packet")) L->dev_packet=atoi(v);
+            else if(!strcmp(k,"wire_format")){
+                if(!strcasecmp(v,"rgb565")) L->wire_format=WIRE_RGB565;
+                else if(!strcasecmp(v,"jpeg")) L->wire_format=WIRE_JPEG;
+                else if(!strcasecmp(v,"probe")) L->wire_format=WIRE_PROBE;
+                else fprintf(stderr,"wire_format must be rgb565|jpeg|probe\n");
+            }
+            else if(!strcmp(k,"wire_fmt")) L->wire_fmt=atoi(v);
+            else if(!strcmp(k,"jpeg_quality")) L->jpeg_quality=atoi(v);
+            else if(!strcmp(k,"wire_probe_fmts")) { L->wire_probe_fmts[0]=0; strncat(L->wire_probe_fmts,v,sizeof(L->wire_probe_fmts)-1); }
+            else if(!strcmp(k,"wire_probe_hold_ms")) L->wire_probe_hold_ms=atoi(v);
             else if(!strcmp(k,"debug")) L->debug=atoi(v);
+            else if(!strcmp(k,"page_duration_ms")) L->page_duration_ms=atoi(v);
+            else if(!strcmp(k,"transition")){ int t=parse_transition(v); if(t>=0) L->transition=t; }
+            else if(!strcmp(k,"transition_ms")) L->transition_ms=atoi(v);
+            else if(!strcmp(k,"memory_budget_mb")) L->memory_budget_mb=atoi(v);
+            else if(!strcmp(k,"background_storage")){ if(parse_store(v,&L->bg_storage)!=0) fprintf(stderr,"background_storage must be auto|raw|rle|stream\n"); }
+            else if(!strcmp(k,"asset_placeholder")){ if(parse_rgbA(v,&L->placeholder_r,&L->placeholder_g,&L->placeholder_b,&L->placeholder_a)!=0) fprintf(stderr,"Bad asset_placeholder\n"); }
 
             else if(!strcmp(k,"default_ttf")) { strncpy(L->default_ttf,v,sizeof(L->default_ttf)-1); }
             else if(!strcmp(k,"default_ttf_px")) L->default_ttf_px=atoi(v);
@@ -286,6 +645,8 @@ static int load_layout(const char *path, Layout *L){
             // background APNG tuning
             else if(!strcmp(k,"apng_speed")) L->bg_apng_speed=atof(v);
             else if(!strcmp(k,"apng_start_ms")) L->bg_apng_start_ms=(int64_t)atoll(v);
+            else if(!strcmp(k,"apng_resample")){ int r=parse_resample(v); if(r>=0) L->apng_resample=r; }
+            else if(!strcmp(k,"background_update_hz")) L->bg_update_hz=atof(v);
             else if(!strcmp(k,"apng_loop")){
                 if(!strcasecmp(v,"default")){ L->bg_apng_loop_mode=0; }
                 else if(!strcasecmp(v,"infinite")){ L->bg_apng_loop_mode=1; }
@@ -293,18 +654,45 @@ static int load_layout(const char *path, Layout *L){
                 else { L->bg_apng_loop_mode=3; L->bg_apng_loop_N=atoi(v); if(L->bg_apng_loop_N<0)L->bg_apng_loop_N=0; }
             }
 
+        } else if(sec==SEC_PAGE){
+            Page *pg=&L->pages[cur_page];
+            if(!strcmp(k,"name")){ strncpy(pg->name,v,sizeof(pg->name)-1); pg->name[sizeof(pg->name)-1]=0; }
+            else if(!strcmp(k,"duration_ms")) pg->duration_ms=atoi(v);
+            else if(!strcmp(k,"visible_if")){ free(pg->visible_if); pg->visible_if=strdup(v); }
+            else if(!strcmp(k,"alert")) pg->alert=atoi(v)!=0;
+            else if(!strcmp(k,"transition")){ int t=parse_transition(v); if(t>=0) pg->transition=t; }
+            else if(!strcmp(k,"transition_ms")) pg->transition_ms=atoi(v);
+
         } else if(sec==SEC_OVERLAY){
-            static Overlay ov;
             if(!strcmp(k,"rect")){
-                if(parse_rect(v,&ov.x,&ov.y,&ov.w,&ov.h)!=0) fprintf(stderr,"Bad overlay rect\n");
+                if(have_ov){ add_overlay(L,cur_ov); overlay_defaults(&cur_ov,cur_page); }
+                if(parse_rect(v,&cur_ov.x,&cur_ov.y,&cur_ov.w,&cur_ov.h)!=0) fprintf(stderr,"Bad overlay rect\n");
+                have_ov=1;
             } else if(!strcmp(k,"color")){
-                if(parse_rgbA(v,&ov.r,&ov.g,&ov.b,&ov.a)!=0) fprintf(stderr,"Bad overlay color\n");
-                add_overlay(L,ov); memset(&ov,0,sizeof ov);
+                if(parse_rgbA(v,&cur_ov.r,&cur_ov.g,&cur_ov.b,&cur_ov.a)!=0) fprintf(stderr,"Bad overlay color\n");
+            } else if(!strcmp(k,"visible_if")){ free(cur_ov.visible_if); cur_ov.visible_if=strdup(v); }
+            else if(!strcmp(k,"page")){ if(parse_page_ref(L,v,&cur_ov.page)!=0) fprintf(stderr,"[overlay] unknown page '%s'\n",v); }
+            else if(!strcmp(k,"shape")){
+                if(!strcasecmp(v,"rect")) cur_ov.shape=0; else if(!strcasecmp(v,"ellipse")) cur_ov.shape=1;
+                else fprintf(stderr,"[overlay] shape must be rect|ellipse\n");
             }
+            else if(!strcmp(k,"radius")){ int n=atoi(v); cur_ov.radius = n<0? 0 : n; }
+            else if(!strcmp(k,"border")){ int n=atoi(v); cur_ov.border = n<0? 0 : n; }
+            else if(!strcmp(k,"border_color")){ if(parse_rgbA(v,&cur_ov.br,&cur_ov.bg,&cur_ov.bb,&cur_ov.ba)!=0) fprintf(stderr,"Bad overlay border_color\n"); }
+            else if(!strcmp(k,"gradient")){
+                if(!strcasecmp(v,"none")) cur_ov.gradient=0; else if(!strcasecmp(v,"linear")) cur_ov.gradient=1;
+                else if(!strcasecmp(v,"radial")) cur_ov.gradient=2; else fprintf(stderr,"[overlay] gradient must be none|linear|radial\n");
+            }
+            else if(!strcmp(k,"color2")){ if(parse_rgbA(v,&cur_ov.r2,&cur_ov.g2,&cur_ov.b2,&cur_ov.a2)!=0) fprintf(stderr,"Bad overlay color2\n"); }
+            else if(!strcmp(k,"gradient_angle")) cur_ov.angle=(float)atof(v);
+            else if(!strcmp(k,"update_hz")) cur_ov.update_hz=atof(v);
 
         } else if(sec==SEC_TEXT){
             have_text=1;
-            if(!strcmp(k,"text")){ if(cur_text.text) free(cur_text.text); cur_text.text=strdup(v); }
+            if(!strcmp(k,"text")){
+                if(cur_text.text) free(cur_text.text); cur_text.text=strdup(v);
+                char *d=cur_text.text; for(const char *c=cur_text.text;*c;c++){ if(c[0]=='\\' && c[1]=='n'){ *d++='\n'; c++; } else *d++=*c; } *d=0;
+            }
             else if(!strcmp(k,"x")) cur_text.x=atoi(v);
             else if(!strcmp(k,"y")) cur_text.y=atoi(v);
             else if(!strcmp(k,"color")){ if(parse_rgbA(v,&cur_text.r,&cur_text.g,&cur_text.b,&cur_text.a)!=0) fprintf(stderr,"Bad text color\n"); }
@@ -325,6 +713,22 @@ static int load_layout(const char *path, Layout *L){
                 if(cur_text.ttf_path) free(cur_text.ttf_path); cur_text.ttf_path=strdup(v);
             } else if(!strcmp(k,"ttf_px")){
                 cur_text.ttf_px=atoi(v);
+            } else if(!strcmp(k,"visible_if")){
+                free(cur_text.visible_if); cur_text.visible_if=strdup(v);
+            } else if(!strcmp(k,"page")){
+                if(parse_page_ref(L,v,&cur_text.page)!=0) fprintf(stderr,"[text] unknown page '%s'\n",v);
+            }
+            else if(!strcmp(k,"scroll")){ float f=(float)atof(v); cur_text.scroll = f<0? 0 : f; }
+            else if(!strcmp(k,"scroll_width")) cur_text.scroll_w=atoi(v);
+            else if(!strcmp(k,"scroll_gap")){ int g=atoi(v); cur_text.scroll_gap = g<0? 0 : g; }
+            else if(!strcmp(k,"update_hz")) cur_text.update_hz=atof(v);
+            else if(!strcmp(k,"width")) cur_text.box_w=atoi(v);
+            else if(!strcmp(k,"height")) cur_text.box_h=atoi(v);
+            else if(!strcmp(k,"max_lines")) cur_text.max_lines=atoi(v);
+            else if(!strcmp(k,"ellipsis")){ free(cur_text.ellipsis); cur_text.ellipsis=strdup(v); }
+            else if(!strcmp(k,"align")){
+                if(!strcasecmp(v,"left")) cur_text.align=0; else if(!strcasecmp(v,"center")) cur_text.align=1;
+                else if(!strcasecmp(v,"right")) cur_text.align=2; else fprintf(stderr,"[text] align must be left|center|right\n");
             }
 
         } else if(sec==SEC_IMAGE){
@@ -336,27 +740,81 @@ static int load_layout(const char *path, Layout *L){
             else if(!strcmp(k,"scale")) cur_img.scale=(float)atof(v);
             else if(!strcmp(k,"apng_speed")) cur_img.apng_speed=atof(v);
             else if(!strcmp(k,"apng_start_ms")) cur_img.apng_start_ms=(int64_t)atoll(v);
+            else if(!strcmp(k,"apng_resample")){ int r=parse_resample(v); if(r>=0) cur_img.apng_resample=r; }
+            else if(!strcmp(k,"update_hz")) cur_img.update_hz=atof(v);
             else if(!strcmp(k,"apng_loop")){
                 if(!strcasecmp(v,"default")){ cur_img.apng_loop_mode=0; }
                 else if(!strcasecmp(v,"infinite")){ cur_img.apng_loop_mode=1; }
                 else if(!strcasecmp(v,"once")){ cur_img.apng_loop_mode=2; }
                 else { cur_img.apng_loop_mode=3; cur_img.apng_loop_N=atoi(v); if(cur_img.apng_loop_N<0) cur_img.apng_loop_N=0; }
             }
+            else if(!strcmp(k,"visible_if")){ free(cur_img.visible_if); cur_img.visible_if=strdup(v); }
+            else if(!strcmp(k,"page")){ if(parse_page_ref(L,v,&cur_img.page)!=0) fprintf(stderr,"[image] unknown page '%s'\n",v); }
+            else if(!strcmp(k,"storage")){ if(parse_store(v,&cur_img.storage)!=0) fprintf(stderr,"[image] storage must be auto|raw|rle|stream\n"); }
+            else if(!strcmp(k,"frame_from")){ free(cur_img.frame_from); cur_img.frame_from=strdup(v); }
+            else if(!strcmp(k,"frame_range")){
+                if(sscanf(v,"%lf,%lf",&cur_img.frame_min,&cur_img.frame_max)!=2 || cur_img.frame_min==cur_img.frame_max){
+                    fprintf(stderr,"[image] frame_range must be <min>,<max>\n"); cur_img.frame_min=0; cur_img.frame_max=100;
+                }
+            }
+            else if(!strcmp(k,"rotate_from")){ free(cur_img.rotate_from); cur_img.rotate_from=strdup(v); }
+            else if(!strcmp(k,"rotate_range")){
+                if(sscanf(v,"%lf,%lf",&cur_img.rot.v0,&cur_img.rot.v1)!=2 || cur_img.rot.v0==cur_img.rot.v1){
+                    fprintf(stderr,"[image] rotate_range must be <min>,<max>\n"); cur_img.rot.v0=0; cur_img.rot.v1=100;
+                }
+            }
+            else if(!strcmp(k,"rotate_angles")){
+                if(sscanf(v,"%lf,%lf",&cur_img.rot.a0,&cur_img.rot.a1)!=2){ fprintf(stderr,"[image] rotate_angles must be <deg>,<deg>\n"); cur_img.rot.a0=0; cur_img.rot.a1=360; }
+            }
+            else if(!strcmp(k,"rotate_step")){ double d=atof(v); cur_img.rot.step = d<0.1?0.1 : d>90?90 : d; }
+            else if(!strcmp(k,"rotate_cache")){ int n=atoi(v); cur_img.rot.cache = n<1?1 : n>4096?4096 : n; }
+            else if(!strcmp(k,"pivot")){
+                if(sscanf(v,"%f,%f",&cur_img.rot.pvx,&cur_img.rot.pvy)!=2){ fprintf(stderr,"[image] pivot must be <x>,<y>\n"); cur_img.rot.pvx=cur_img.rot.pvy=NAN; }
+            }
         }
     }
     if(sec==SEC_TEXT && have_text && cur_text.text){ add_text(L,cur_text); }
-    else { if(cur_text.text) free(cur_text.text); if(cur_text.ttf_path) free(cur_text.ttf_path); }
+    else { free(cur_text.text); free(cur_text.ttf_path); free(cur_text.visible_if); free(cur_text.ellipsis); }
     if(sec==SEC_IMAGE && have_img && cur_img.path){ add_img(L,cur_img); }
-    else if(cur_img.path){ free(cur_img.path); }
+    else { free(cur_img.path); free(cur_img.visible_if); free(cur_img.frame_from); free(cur_img.rotate_from); }
+    if(sec==SEC_OVERLAY && have_ov){ add_overlay(L,cur_ov); }
+    else free(cur_ov.visible_if);
     fclose(f);
 
-    if(L->background_png[0]==0){ fprintf(stderr,"layout.cfg missing 'background_png='\n"); return -1; }
+    if(L->background_png[0]==0 && !L->bg_fill){ fprintf(stderr,"layout.cfg missing 'background_png=' (or background_color=/background_gradient=)\n"); return -1; }
     if(L->fb_scale_percent<100) L->fb_scale_percent=100;
     if(L->bg_apng_speed<=0) L->bg_apng_speed=1.0;
     for(int i=0;i<L->n_imgs;i++){ if(L->imgs[i].apng_speed<=0) L->imgs[i].apng_speed=1.0; }
+    if(L->page_duration_ms<=0) L->page_duration_ms=5000;
+    if(L->memory_budget_mb<0) L->memory_budget_mb=0;
+    for(int i=0;i<L->n_pages;i++){ if(L->pages[i].duration_ms<=0) L->pages[i].duration_ms=L->page_duration_ms; }
 
     return 0;
 }
+static void layout_free(Layout *L){
+    for(int i=0;i<L->n_texts;i++){ free(L->texts[i].text); free(L->texts[i].ttf_path); free(L->texts[i].visible_if); free(L->texts[i].ellipsis); }
+    for(int i=0;i<L->n_imgs;i++){ free(L->imgs[i].path); free(L->imgs[i].visible_if); free(L->imgs[i].frame_from); free(L->imgs[i].rotate_from); }
+    for(int i=0;i<L->n_overlays;i++) free(L->overlays[i].visible_if);
+    for(int i=0;i<L->n_pages;i++) free(L->pages[i].visible_if);
+    free(L->texts); free(L->overlays); free(L->imgs); free(L->pages);
+    L->texts=NULL; L->overlays=NULL; L->imgs=NULL; L->pages=NULL;
+    L->n_texts=L->n_overlays=L->n_imgs=L->n_pages=0;
+}
+// Keys that only take effect at startup keep their running values when the
+// layout is reloaded; returns 1 if the new file changed any of them.
+static int layout_keep_fixed(Layout *N, const Layout *O){
+    int changed = strcmp(N->device,O->device) || N->dev_vid!=O->dev_vid || N->dev_pid!=O->dev_pid ||
+                  N->dev_w!=O->dev_w || N->dev_h!=O->dev_h || N->dev_packet!=O->dev_packet || N->iface!=O->iface ||
+                  N->wire_format!=O->wire_format || N->wire_fmt!=O->wire_fmt || N->jpeg_quality!=O->jpeg_quality ||
+                  N->memory_budget_mb!=O->memory_budget_mb || N->tx_sched!=O->tx_sched || N->tx_priority!=O->tx_priority ||
+                  N->tx_nice!=O->tx_nice || N->tx_cpu!=O->tx_cpu || N->tx_mlock!=O->tx_mlock;
+    memcpy(N->device,O->device,sizeof N->device);
+    N->dev_vid=O->dev_vid; N->dev_pid=O->dev_pid; N->dev_w=O->dev_w; N->dev_h=O->dev_h; N->dev_packet=O->dev_packet; N->iface=O->iface;
+    N->wire_format=O->wire_format; N->wire_fmt=O->wire_fmt; N->jpeg_quality=O->jpeg_quality;
+    N->memory_budget_mb=O->memory_budget_mb;
+    N->tx_sched=O->tx_sched; N->tx_priority=O->tx_priority; N->tx_nice=O->tx_nice; N->tx_cpu=O->tx_cpu; N->tx_mlock=O->tx_mlock;
+    return changed;
+}
 
 // Token Metrics ------------------------------------------------------------------
 typedef struct {
@@ -367,62 +825,223 @@ typedef struct {
     int have_gpu_usage; float gpu_usage_pct;
     char time_hhmm[8];
     char date_ymd[16];
+    int  time_num;              // HHMM as a number, for conditions
+    int  date_num;              // YYYYMMDD as a number
+    double clock_s;             // local time of day in seconds, with the fraction (clock hands)
 } Metrics;
 
-static int read_file_ll(const char *path, long long *out){
-    FILE *f=fopen(path,"r"); if(!f) return -1;
-    char buf[128]; if(!fgets(buf,sizeof buf,f)){ fclose(f); return -1; }
-    fclose(f); char *e=NULL; errno=0; long long v=strtoll(buf,&e,10); if(errno) return -1; *out=v; return 0;
+// Sensor files are found once (and again after a SIGHUP reload) and kept open;
+// every sample re-reads them from offset 0 into fixed buffers. metrics_io=uring
+// submits a whole sample as one io_uring batch instead of one pread per file,
+// and falls back to pread if io_uring is unavailable (old kernel, seccomp).
+enum { SN_STAT=1, SN_MEMINFO=2, SN_CPU_TZ=4, SN_CPU_HWMON=8, SN_GPU_TEMP=16, SN_GPU_BUSY=32 };
+typedef struct { int fd, roles, cap, len; char *buf; } SensorFile;
+#ifdef TRLCD_URING
+typedef struct {
+    int fd; unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes; struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr; size_t sq_sz, cq_sz, sqe_sz;
+} Uring;
+#endif
+static struct {
+    int open, want_uring;
+    SensorFile *f; int n, cap;
+    char *bufs;
+#ifdef TRLCD_URING
+    Uring ring; int have_ring;
+#endif
+} g_sensors;
+
+#ifdef TRLCD_URING
+static void uring_free(Uring *u){
+    if(u->sqes) munmap(u->sqes,u->sqe_sz);
+    if(u->cq_ptr && u->cq_ptr!=u->sq_ptr) munmap(u->cq_ptr,u->cq_sz);
+    if(u->sq_ptr) munmap(u->sq_ptr,u->sq_sz);
+    if(u->fd>=0) close(u->fd);
+    memset(u,0,sizeof *u); u->fd=-1;
+}
+static int uring_init(Uring *u, unsigned entries){
+    memset(u,0,sizeof *u); u->fd=-1;
+    struct io_uring_params p; memset(&p,0,sizeof p);
+    u->fd=(int)syscall(__NR_io_uring_setup,entries,&p); if(u->fd<0) return -1;
+    u->sq_sz=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    u->cq_sz=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    int single=(p.features & IORING_FEAT_SINGLE_MMAP)!=0;
+    if(single){ if(u->cq_sz>u->sq_sz) u->sq_sz=u->cq_sz; u->cq_sz=u->sq_sz; }
+    void *sq=mmap(NULL,u->sq_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQ_RING);
+    if(sq==MAP_FAILED){ uring_free(u); return -1; } u->sq_ptr=sq;
+    void *cq=single? sq : mmap(NULL,u->cq_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_CQ_RING);
+    if(cq==MAP_FAILED){ uring_free(u); return -1; } u->cq_ptr=cq;
+    u->sqe_sz=p.sq_entries*sizeof(struct io_uring_sqe);
+    void *sqes=mmap(NULL,u->sqe_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQES);
+    if(sqes==MAP_FAILED){ uring_free(u); return -1; } u->sqes=(struct io_uring_sqe*)sqes;
+    char *s=(char*)sq, *c=(char*)cq;
+    u->sq_head=(unsigned*)(s+p.sq_off.head); u->sq_tail=(unsigned*)(s+p.sq_off.tail);
+    u->sq_mask=(unsigned*)(s+p.sq_off.ring_mask); u->sq_array=(unsigned*)(s+p.sq_off.array);
+    u->cq_head=(unsigned*)(c+p.cq_off.head); u->cq_tail=(unsigned*)(c+p.cq_off.tail);
+    u->cq_mask=(unsigned*)(c+p.cq_off.ring_mask); u->cqes=(struct io_uring_cqe*)(c+p.cq_off.cqes);
+    u->entries=p.sq_entries;
+    // IORING_OP_READ needs 5.6; so does the probe, so a failed probe means no
+    size_t psz=sizeof(struct io_uring_probe)+256*sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *pr=(struct io_uring_probe*)calloc(1,psz); if(!pr) die("calloc io_uring probe");
+    int ok=syscall(__NR_io_uring_register,u->fd,IORING_REGISTER_PROBE,pr,256)==0 && pr->last_op>=IORING_OP_READ &&
+           (pr->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(pr);
+    if(!ok){ uring_free(u); errno=EOPNOTSUPP; return -1; }
+    return 0;
+}
+// Reads the selected files in batches of up to ring size: one io_uring_enter
+// submits a batch and waits for all of it. -1 = io_uring itself failed.
+static int uring_read_all(Uring *u, SensorFile **sel, int n){
+    for(int i0=0;i0<n;){
+        unsigned cnt=(unsigned)(n-i0)<u->entries? (unsigned)(n-i0) : u->entries;
+        unsigned tail=*u->sq_tail, mask=*u->sq_mask;
+        for(unsigned k=0;k<cnt;k++){
+            SensorFile *f=sel[i0+k]; unsigned idx=tail&mask;
+            struct io_uring_sqe *q=&u->sqes[idx]; memset(q,0,sizeof *q);
+            q->opcode=IORING_OP_READ; q->fd=f->fd; q->off=0;
+            q->addr=(uint64_t)(uintptr_t)f->buf; q->len=(unsigned)(f->cap-1); q->user_data=(uint64_t)(i0+k);
+            u->sq_array[idx]=idx; tail++;
+        }
+        __atomic_store_n(u->sq_tail,tail,__ATOMIC_RELEASE);
+        unsigned to_submit=cnt, got=0;
+        while(got<cnt){
+            int r=(int)syscall(__NR_io_uring_enter,u->fd,to_submit,1,IORING_ENTER_GETEVENTS,NULL,0);
+            if(r<0){ if(errno==EINTR) continue; return -1; }
+            to_submit-= (unsigned)r<to_submit? (unsigned)r : to_submit;
+            unsigned head=*u->cq_head;
+            while(head!=__atomic_load_n(u->cq_tail,__ATOMIC_ACQUIRE)){
+                struct io_uring_cqe *e=&u->cqes[head & *u->cq_mask];
+                sel[e->user_data]->len=e->res<0? -1 : e->res;
+                head++; got++;
+            }
+            __atomic_store_n(u->cq_head,head,__ATOMIC_RELEASE);
+        }
+        i0+=(int)cnt;
+    }
+    return 0;
+}
+#endif
+
+static void sensor_add(const char *path, int roles, int cap){
+    int fd=open(path,O_RDONLY|O_CLOEXEC); if(fd<0) return;
+    if(g_sensors.n==g_sensors.cap){
+        g_sensors.cap=g_sensors.cap?g_sensors.cap*2:32;
+        g_sensors.f=(SensorFile*)realloc(g_sensors.f,(size_t)g_sensors.cap*sizeof(SensorFile)); if(!g_sensors.f) die("realloc sensors");
+    }
+    SensorFile *f=&g_sensors.f[g_sensors.n++]; memset(f,0,sizeof *f);
+    f->fd=fd; f->roles=roles; f->cap=cap; f->len=-1;
+}
+static int read_small(const char *path, char *buf, size_t sz){
+    int fd=open(path,O_RDONLY|O_CLOEXEC); if(fd<0) return -1;
+    ssize_t n=read(fd,buf,sz-1); close(fd); if(n<0) return -1;
+    buf[n]=0; for(char *p=buf;*p;p++) if(*p=='\n'||*p=='\r') *p=0;
+    return 0;
+}
+static void sensors_close(void){
+    for(int i=0;i<g_sensors.n;i++) close(g_sensors.f[i].fd);
+    free(g_sensors.f); free(g_sensors.bufs);
+#ifdef TRLCD_URING
+    if(g_sensors.have_ring) uring_free(&g_sensors.ring);
+#endif
+    int want=g_sensors.want_uring;
+    memset(&g_sensors,0,sizeof g_sensors); g_sensors.want_uring=want;
 }
-static int read_file_u64(const char *path, unsigned long long *out){
-    FILE *f=fopen(path,"r"); if(!f) return -1;
-    unsigned long long v=0; if(fscanf(f,"%llu",&v)!=1){ fclose(f); return -1; } fclose(f); *out=v; return 0;
+static void sensors_open(void){
+    char p[320];                // fits /sys/class/drm/<d_name>/device/<busy file>
+    sensor_add("/proc/stat",SN_STAT,256);
+    sensor_add("/proc/meminfo",SN_MEMINFO,256);
+    for(int i=0;i<32;i++){ snprintf(p,sizeof p,"/sys/class/thermal/thermal_zone%d/temp",i); sensor_add(p,SN_CPU_TZ,32); }
+    // hwmon0..15 count as CPU temperature, and any hwmon named after a GPU driver as GPU temperature
+    static const char *const gpu_names[]={"amdgpu","nvidia","nouveau","i915","xe"};
+    for(int h=0;h<32;h++){
+        char nm[64]; snprintf(p,sizeof p,"/sys/class/hwmon/hwmon%d/name",h);
+        int gpu=0; if(read_small(p,nm,sizeof nm)==0)
+            for(size_t i=0;i<sizeof(gpu_names)/sizeof(gpu_names[0]);i++) if(!strcasecmp(nm,gpu_names[i])){ gpu=1; break; }
+        int roles=(h<16? SN_CPU_HWMON : 0)|(gpu? SN_GPU_TEMP : 0); if(!roles) continue;
+        for(int t=1;t<=8;t++){ snprintf(p,sizeof p,"/sys/class/hwmon/hwmon%d/temp%d_input",h,t); sensor_add(p,roles,32); }
+    }
+    // DRM busy: the first readable of the three per-driver names, per card
+    DIR *d=opendir("/sys/class/drm");
+    if(d){ struct dirent *de; static const char *const busy[]={"gpu_busy_percent","busy_percent","gt_busy_percent"};
+        while((de=readdir(d))){ if(strncmp(de->d_name,"card",4)!=0) continue;
+            for(int k=0;k<3;k++){ char b[32];
+                if(snprintf(p,sizeof p,"/sys/class/drm/%s/device/%s",de->d_name,busy[k])>=(int)sizeof p) break; // never open a cut path
+                if(read_small(p,b,sizeof b)==0){ sensor_add(p,SN_GPU_BUSY,32); break; } } }
+        closedir(d); }
+
+    size_t total=0; for(int i=0;i<g_sensors.n;i++) total+=(size_t)g_sensors.f[i].cap;
+    g_sensors.bufs=(char*)malloc(total?total:1); if(!g_sensors.bufs) die("malloc sensor buffers");
+    for(int i=0,o=0;i<g_sensors.n;i++){ g_sensors.f[i].buf=g_sensors.bufs+o; o+=g_sensors.f[i].cap; }
+#ifdef TRLCD_URING
+    if(g_sensors.want_uring && g_sensors.n){
+        g_sensors.have_ring = uring_init(&g_sensors.ring,(unsigned)(g_sensors.n<256?g_sensors.n:256))==0;
+        if(!g_sensors.have_ring) fprintf(stderr,"[metrics] io_uring unavailable (%s), using pread\n", strerror(errno));
+    }
+#else
+    if(g_sensors.want_uring) fprintf(stderr,"[metrics] built without io_uring, using pread\n");
+#endif
+    g_sensors.open=1;
+}
+// Reads every open sensor file with one of the given roles
+static void sensors_sample(int roles){
+    if(!g_sensors.open) sensors_open();
+    SensorFile *sel[512]; int n=0;
+    for(int i=0;i<g_sensors.n && n<512;i++) if(g_sensors.f[i].roles & roles){ g_sensors.f[i].len=-1; sel[n++]=&g_sensors.f[i]; }
+#ifdef TRLCD_URING
+    if(g_sensors.have_ring && uring_read_all(&g_sensors.ring,sel,n)!=0){
+        fprintf(stderr,"[metrics] io_uring read failed (%s), using pread\n", strerror(errno));
+        uring_free(&g_sensors.ring); g_sensors.have_ring=0;
+    }
+    if(!g_sensors.have_ring)
+#endif
+    for(int i=0;i<n;i++){ ssize_t r=pread(sel[i]->fd,sel[i]->buf,(size_t)(sel[i]->cap-1),0); sel[i]->len=r<0? -1 : (int)r; }
+    for(int i=0;i<n;i++) if(sel[i]->len>=0) sel[i]->buf[sel[i]->len]=0;
+}
+static int parse_ll(const SensorFile *f, long long *out){
+    if(f->len<=0) return -1;
+    char *e=NULL; errno=0; long long v=strtoll(f->buf,&e,10); if(errno || e==f->buf) return -1; *out=v; return 0;
 }
 static int get_cpu_temp_c(float *out_c){
     long long best=-1;
-    for(int i=0;i<32;i++){ char p[128]; snprintf(p,sizeof p,"/sys/class/thermal/thermal_zone%d/temp",i);
-        long long v; if(read_file_ll(p,&v)==0){ if(v>1000) v=(v+5)/10; if(v>best) best=v; } }
-    for(int h=0;h<16;h++)for(int t=1;t<=8;t++){ char p[160]; snprintf(p,sizeof p,"/sys/class/hwmon/hwmon%d/temp%d_input",h,t);
-        long long v; if(read_file_ll(p,&v)==0){ if(v>1000) v=v/100; if(v>best) best=v; } }
+    for(int i=0;i<g_sensors.n;i++){ const SensorFile *f=&g_sensors.f[i]; long long v;
+        if(!(f->roles&(SN_CPU_TZ|SN_CPU_HWMON)) || parse_ll(f,&v)!=0) continue;
+        if(v>1000) v= (f->roles&SN_CPU_TZ)? (v+5)/10 : v/100;
+        if(v>best) best=v; }
     if(best<0) return -1; *out_c = best/10.0f; return 0;
 }
 static int read_cpu_totals(uint64_t *idle, uint64_t *total){
-    FILE *f=fopen("/proc/stat","r"); if(!f) return -1; char line[256];
-    if(!fgets(line,sizeof line,f)){ fclose(f); return -1; } fclose(f);
-    unsigned long long u=0,n=0,s=0,i=0,w=0,irq=0,sirq=0,st=0;
-    int c=sscanf(line,"cpu %llu %llu %llu %llu %llu %llu %llu %llu",&u,&n,&s,&i,&w,&irq,&sirq,&st);
-    if(c<4) return -1; *idle = i+w; *total = u+n+s+*idle+irq+sirq+st; return 0;
+    for(int i=0;i<g_sensors.n;i++){ const SensorFile *f=&g_sensors.f[i];
+        if(!(f->roles&SN_STAT) || f->len<=0) continue;
+        unsigned long long u=0,n=0,s=0,id=0,w=0,irq=0,sirq=0,st=0;
+        int c=sscanf(f->buf,"cpu %llu %llu %llu %llu %llu %llu %llu %llu",&u,&n,&s,&id,&w,&irq,&sirq,&st);
+        if(c<4) return -1; *idle = id+w; *total = u+n+s+*idle+irq+sirq+st; return 0; }
+    return -1;
 }
 static int get_mem_total_avail_kb(unsigned long long *tot_kb, unsigned long long *avail_kb){
-    FILE *f=fopen("/proc/meminfo","r"); if(!f) return -1; char key[64]; unsigned long long val=0; char unit[16];
-    unsigned long long total=0,avail=0;
-    while(fscanf(f,"%63[^:]: %llu %15s\n",key,&val,unit)==3){ if(!strcmp(key,"MemTotal")) total=val; else if(!strcmp(key,"MemAvailable")) avail=val; }
-    fclose(f); if(total==0||avail==0) return -1; *tot_kb=total; *avail_kb=avail; return 0;
+    for(int i=0;i<g_sensors.n;i++){ const SensorFile *f=&g_sensors.f[i];
+        if(!(f->roles&SN_MEMINFO) || f->len<=0) continue;
+        unsigned long long total=0,avail=0;
+        for(const char *l=f->buf; l && *l; ){ char key[64]; unsigned long long val=0;
+            if(sscanf(l,"%63[^:]: %llu",key,&val)==2){ if(!strcmp(key,"MemTotal")) total=val; else if(!strcmp(key,"MemAvailable")) avail=val; }
+            l=strchr(l,'\n'); if(l) l++; }
+        if(total==0||avail==0) return -1; *tot_kb=total; *avail_kb=avail; return 0; }
+    return -1;
 }
 static int get_gpu_temp_c(float *out_c){
-    const char *names[]={"amdgpu","nvidia","nouveau","i915","xe"}; float best=-1.0f;
-    for(int h=0;h<32;h++){
-        char namep[128]; snprintf(namep,sizeof namep,"/sys/class/hwmon/hwmon%d/name",h);
-        FILE *nf=fopen(namep,"r"); if(!nf) continue; char nm[64]={0}; if(!fgets(nm,sizeof nm,nf)){ fclose(nf); continue; } fclose(nf);
-        for(char *p=nm;*p;p++) if(*p=='\n'||*p=='\r') *p=0; int ok=0;
-        for(size_t i=0;i<sizeof(names)/sizeof(names[0]);i++) if(!strcasecmp(nm,names[i])){ ok=1; break; }
-        if(!ok) continue;
-        for(int t=1;t<=8;t++){ char tp[160]; snprintf(tp,sizeof tp,"/sys/class/hwmon/hwmon%d/temp%d_input",h,t);
-            long long v; if(read_file_ll(tp,&v)==0){ float c=(v>=1000)?(v/1000.0f):(v/1.0f); if(c>best) best=c; } }
-    }
+    float best=-1.0f;
+    for(int i=0;i<g_sensors.n;i++){ const SensorFile *f=&g_sensors.f[i]; long long v;
+        if(!(f->roles&SN_GPU_TEMP) || parse_ll(f,&v)!=0) continue;
+        float c=(v>=1000)?(v/1000.0f):(v/1.0f); if(c>best) best=c; }
     if(best<0) return -1; *out_c=best; return 0;
 }
 static int get_gpu_usage_pct(float *out_pct){
-    DIR *d=opendir("/sys/class/drm"); if(!d) return -1; struct dirent *de; float best=-1.0f;
-    while((de=readdir(d))){ if(strncmp(de->d_name,"card",4)!=0) continue; char p1[256]; unsigned long long v=0;
-        snprintf(p1,sizeof p1,"/sys/class/drm/%s/device/gpu_busy_percent",de->d_name);
-        if(read_file_u64(p1,&v)==0){ if((float)v>best) best=(float)v; continue; }
-        snprintf(p1,sizeof p1,"/sys/class/drm/%s/device/busy_percent",de->d_name);
-        if(read_file_u64(p1,&v)==0){ if((float)v>best) best=(float)v; continue; }
-        snprintf(p1,sizeof p1,"/sys/class/drm/%s/device/gt_busy_percent",de->d_name);
-        if(read_file_u64(p1,&v)==0){ if((float)v>best) best=(float)v; continue; }
-    }
-    closedir(d); if(best<0) return -1; if(best>100.0f) best=100.0f; *out_pct=best; return 0;
+    float best=-1.0f;
+    for(int i=0;i<g_sensors.n;i++){ const SensorFile *f=&g_sensors.f[i]; long long v;
+        if(!(f->roles&SN_GPU_BUSY) || parse_ll(f,&v)!=0 || v<0) continue;
+        if((float)v>best) best=(float)v; }
+    if(best<0) return -1; if(best>100.0f) best=100.0f; *out_pct=best; return 0;
 }
 static void metrics_init(Metrics *m){ memset(m,0,sizeof *m); }
 static void fmt_bytes_short(unsigned long long bytes, char out[16]){
@@ -433,10 +1052,15 @@ static void fmt_bytes_short(unsigned long long bytes, char out[16]){
     else snprintf(out,16,"%.2f%s",v,u[idx]);
 }
 static void update_metrics(Metrics *m, int blocking_initial){
-    time_t now=time(NULL); struct tm lt; localtime_r(&now,&lt);
+    struct timespec rt; clock_gettime(CLOCK_REALTIME,&rt);
+    time_t now=rt.tv_sec; struct tm lt; localtime_r(&now,&lt);
+    m->clock_s = lt.tm_hour*3600 + lt.tm_min*60 + lt.tm_sec + rt.tv_nsec/1e9;
     snprintf(m->time_hhmm,sizeof m->time_hhmm,"%02d:%02d", lt.tm_hour, lt.tm_min);
     snprintf(m->date_ymd,sizeof m->date_ymd,"%04d-%02d-%02d", lt.tm_year+1900, lt.tm_mon+1, lt.tm_mday);
+    m->time_num = lt.tm_hour*100 + lt.tm_min;
+    m->date_num = (lt.tm_year+1900)*10000 + (lt.tm_mon+1)*100 + lt.tm_mday;
 
+    sensors_sample(~0);
     float tc; if(get_cpu_temp_c(&tc)==0){ m->have_temp=1; m->temp_c=tc; }
 
     uint64_t idle=0,total=0;
@@ -444,6 +1068,7 @@ static void update_metrics(Metrics *m, int blocking_initial){
         if(!m->prev_valid){
             if(blocking_initial){
                 struct timespec ts={0,60*1000*1000}; nanosleep(&ts,NULL);
+                sensors_sample(SN_STAT);
                 uint64_t i2=0,t2=0; if(read_cpu_totals(&i2,&t2)==0){
                     uint64_t did=i2-idle, dtt=t2-total; if(dtt>0){
                         float used=(float)(dtt-did)*100.0f/(float)dtt; if(used<0)used=0; if(used>100)used=100;
@@ -484,6 +1109,9 @@ static void expand_tokens(char *out, size_t outsz, const char *in, const Metrics
                     else if(!strcmp(tok,"GPU_USAGE")){ if(m&&m->have_gpu_usage){ int p=(int)(m->gpu_usage_pct+0.5f); if(p<0)p=0; if(p>100)p=100; snprintf(repl,64,"%d%%",p);} else snprintf(repl,64,"N/A"); replaced=1; }
                     else if(!strcmp(tok,"TIME")){ snprintf(repl,64,"%s",(m&&m->time_hhmm[0])?m->time_hhmm:"N/A"); replaced=1; }
                     else if(!strcmp(tok,"DATE")){ snprintf(repl,64,"%s",(m&&m->date_ymd[0])?m->date_ymd:"N/A"); replaced=1; }
+                    else if(!strcmp(tok,"CLOCK_H")){ if(m&&m->time_hhmm[0]){ int hh=(int)(m->clock_s/3600)%12; snprintf(repl,64,"%d",hh?hh:12);} else snprintf(repl,64,"N/A"); replaced=1; }
+                    else if(!strcmp(tok,"CLOCK_M")){ if(m&&m->time_hhmm[0]) snprintf(repl,64,"%02d",(int)(m->clock_s/60)%60); else snprintf(repl,64,"N/A"); replaced=1; }
+                    else if(!strcmp(tok,"CLOCK_S")){ if(m&&m->time_hhmm[0]) snprintf(repl,64,"%02d",(int)m->clock_s%60); else snprintf(repl,64,"N/A"); replaced=1; }
                     if(replaced){ size_t rl=strlen(repl); for(size_t r=0;r<rl && oi+1<outsz;r++) out[oi++]=repl[r]; i+=(len+2); continue; }
                 }
             }
@@ -493,6 +1121,120 @@ static void expand_tokens(char *out, size_t outsz, const char *in, const Metrics
     out[oi]=0;
 }
 
+// Conditions (visible_if) ------------------------------------------------------
+// Small expression language over metric tokens, e.g.
+//   visible_if=%GPU_TEMP% > 80 && %CPU_USAGE% >= 50
+// Operators: || && ! == != < <= > >= ( ) and numeric literals. A metric that is
+// currently unavailable evaluates to NaN, which makes every comparison false.
+// Numeric token values: temperatures in °C, usages in %, MEM_* in MiB,
+// TIME as HHMM and DATE as YYYYMMDD; CLOCK_H/M/S are the position on a clock
+// face (0..12 hours, 0..60 minutes/seconds, with fractions) for clock hands.
+
+// Returns 0 and sets *out, 1 if the metric is known but unavailable, -1 if unknown.
+static int metric_value(const Metrics *m, const char *tok, double *out){
+    if(!strcasecmp(tok,"CPU_TEMP"))  { if(m&&m->have_temp){ *out=m->temp_c; return 0; } return 1; }
+    if(!strcasecmp(tok,"CPU_USAGE")) { if(m&&m->have_usage){ *out=m->usage_pct; return 0; } return 1; }
+    if(!strcasecmp(tok,"MEM_USED"))  { if(m&&m->have_mem){ unsigned long long u=(m->mem_total_kb>m->mem_avail_kb)?(m->mem_total_kb-m->mem_avail_kb):0ULL; *out=(double)u/1024.0; return 0; } return 1; }
+    if(!strcasecmp(tok,"MEM_FREE"))  { if(m&&m->have_mem){ *out=(double)m->mem_avail_kb/1024.0; return 0; } return 1; }
+    if(!strcasecmp(tok,"GPU_TEMP"))  { if(m&&m->have_gpu_temp){ *out=m->gpu_temp_c; return 0; } return 1; }
+    if(!strcasecmp(tok,"GPU_USAGE")) { if(m&&m->have_gpu_usage){ *out=m->gpu_usage_pct; return 0; } return 1; }
+    if(!strcasecmp(tok,"TIME"))      { if(m&&m->time_hhmm[0]){ *out=m->time_num; return 0; } return 1; }
+    if(!strcasecmp(tok,"DATE"))      { if(m&&m->date_ymd[0]){ *out=m->date_num; return 0; } return 1; }
+    if(!strcasecmp(tok,"CLOCK_H"))   { if(m&&m->time_hhmm[0]){ *out=fmod(m->clock_s/3600.0,12.0); return 0; } return 1; }
+    if(!strcasecmp(tok,"CLOCK_M"))   { if(m&&m->time_hhmm[0]){ *out=fmod(m->clock_s/60.0,60.0); return 0; } return 1; }
+    if(!strcasecmp(tok,"CLOCK_S"))   { if(m&&m->time_hhmm[0]){ *out=fmod(m->clock_s,60.0); return 0; } return 1; }
+    return -1;
+}
+
+typedef struct { const char *s; const Metrics *m; int err; } CondParser;
+static int cond_truthy(double v){ return !isnan(v) && v!=0.0; }
+static void cp_ws(CondParser *p){ while(isspace((unsigned char)*p->s)) p->s++; }
+static double cp_or(CondParser *p);
+static double cp_unary(CondParser *p){
+    cp_ws(p);
+    if(*p->s=='('){ p->s++; double v=cp_or(p); cp_ws(p); if(*p->s==')') p->s++; else p->err=1; return v; }
+    if(*p->s=='!'){ p->s++; return cond_truthy(cp_unary(p))?0.0:1.0; }
+    if(*p->s=='-'){ p->s++; return -cp_unary(p); }
+    if(*p->s=='%'){
+        const char *e=strchr(p->s+1,'%'); size_t n=e?(size_t)(e-(p->s+1)):0;
+        char tok[32]; if(!e||n==0||n>=sizeof tok){ p->err=1; return NAN; }
+        memcpy(tok,p->s+1,n); tok[n]=0; p->s=e+1;
+        double v=NAN; int rc=metric_value(p->m,tok,&v); if(rc<0) p->err=1;
+        return rc==0? v : NAN;
+    }
+    char *e=NULL; double v=strtod(p->s,&e); if(e==p->s){ p->err=1; return NAN; }
+    p->s=e; return v;
+}
+static double cp_cmp(CondParser *p){
+    double a=cp_unary(p); cp_ws(p);
+    int op=0; // 1 < 2 <= 3 > 4 >= 5 == 6 !=
+    if(!strncmp(p->s,"<=",2)){ op=2; p->s+=2; } else if(!strncmp(p->s,">=",2)){ op=4; p->s+=2; }
+    else if(!strncmp(p->s,"==",2)){ op=5; p->s+=2; } else if(!strncmp(p->s,"!=",2)){ op=6; p->s+=2; }
+    else if(*p->s=='<'){ op=1; p->s++; } else if(*p->s=='>'){ op=3; p->s++; }
+    if(!op) return a;
+    double b=cp_unary(p); if(isnan(a)||isnan(b)) return 0.0;
+    switch(op){ case 1: return a<b; case 2: return a<=b; case 3: return a>b; case 4: return a>=b; case 5: return a==b; default: return a!=b; }
+}
+static double cp_and(CondParser *p){
+    double v=cp_cmp(p);
+    for(;;){ cp_ws(p); if(strncmp(p->s,"&&",2)) return v; p->s+=2; double w=cp_cmp(p); v=(cond_truthy(v)&&cond_truthy(w))?1.0:0.0; }
+}
+static double cp_or(CondParser *p){
+    double v=cp_and(p);
+    for(;;){ cp_ws(p); if(strncmp(p->s,"||",2)) return v; p->s+=2; double w=cp_and(p); v=(cond_truthy(v)||cond_truthy(w))?1.0:0.0; }
+}
+// Empty/NULL expressions are always true; malformed ones are always false.
+static int cond_eval(const char *expr, const Metrics *m){
+    if(!expr||!*expr) return 1;
+    CondParser p={ expr, m, 0 }; double v=cp_or(&p); cp_ws(&p);
+    if(p.err||*p.s) return 0;
+    return cond_truthy(v);
+}
+static int cond_check(const char *expr){
+    if(!expr||!*expr) return 0;
+    CondParser p={ expr, NULL, 0 }; (void)cp_or(&p); cp_ws(&p);
+    return (p.err||*p.s)? -1 : 0;
+}
+// Numeric value of an expression (frame_from); NaN if malformed or unavailable.
+static double cond_value(const char *expr, const Metrics *m){
+    if(!expr||!*expr) return NAN;
+    CondParser p={ expr, m, 0 }; double v=cp_or(&p); cp_ws(&p);
+    return (p.err||*p.s)? NAN : v;
+}
+static void layout_check_conditions(const Layout *L){
+    for(int i=0;i<L->n_pages;i++) if(cond_check(L->pages[i].visible_if)) fprintf(stderr,"[page] %s: bad visible_if \"%s\" (never shown)\n",L->pages[i].name,L->pages[i].visible_if);
+    for(int i=0;i<L->n_imgs;i++) if(cond_check(L->imgs[i].visible_if)) fprintf(stderr,"[image] %s: bad visible_if \"%s\" (never shown)\n",L->imgs[i].path,L->imgs[i].visible_if);
+    for(int i=0;i<L->n_imgs;i++) if(cond_check(L->imgs[i].frame_from)) fprintf(stderr,"[image] %s: bad frame_from \"%s\" (stays on its first frame)\n",L->imgs[i].path,L->imgs[i].frame_from);
+    for(int i=0;i<L->n_imgs;i++) if(cond_check(L->imgs[i].rotate_from)) fprintf(stderr,"[image] %s: bad rotate_from \"%s\" (stays at its first angle)\n",L->imgs[i].path,L->imgs[i].rotate_from);
+    for(int i=0;i<L->n_texts;i++) if(cond_check(L->texts[i].visible_if)) fprintf(stderr,"[text] bad visible_if \"%s\" (never shown)\n",L->texts[i].visible_if);
+    for(int i=0;i<L->n_overlays;i++) if(cond_check(L->overlays[i].visible_if)) fprintf(stderr,"[overlay] bad visible_if \"%s\" (never shown)\n",L->overlays[i].visible_if);
+}
+
+// Pages -------------------------------------------------------------------------
+// Non-alert pages rotate in file order, each for its duration_ms; pages whose
+// visible_if is false are skipped. The first alert page whose condition holds
+// is shown instead of the rotation (which keeps its place underneath).
+typedef struct { int cur; uint64_t since_ms; } PageState;
+
+static int page_eligible(const Layout *L, int i, const Metrics *m){ return cond_eval(L->pages[i].visible_if,m); }
+static int pick_page(const Layout *L, const Metrics *m, uint64_t now_ms, PageState *ps){
+    if(L->n_pages==0) return -1;
+    for(int i=0;i<L->n_pages;i++) if(L->pages[i].alert && page_eligible(L,i,m)) return i;
+    int cur=ps->cur;
+    int stale = cur<0 || cur>=L->n_pages || L->pages[cur].alert || !page_eligible(L,cur,m) ||
+                now_ms - ps->since_ms >= (uint64_t)L->pages[cur].duration_ms;
+    if(!stale) return cur;
+    for(int k=1;k<=L->n_pages;k++){
+        int i=((cur<0?-1:cur)+k+L->n_pages)%L->n_pages;
+        if(!L->pages[i].alert && page_eligible(L,i,m)){ ps->cur=i; ps->since_ms=now_ms; return i; }
+    }
+    ps->cur=-1; return -1; // nothing eligible: only page-less layers are drawn
+}
+static int layer_visible(int page, const char *visible_if, int cur_page, const Metrics *m){
+    if(page>=0 && page!=cur_page) return 0;
+    return cond_eval(visible_if,m);
+}
+
 // RGBA / Blitting ---------------------------------------------------------------
 static void rotate180_rgba(uint8_t *buf, int w, int h){
     size_t px=(size_t)w*h; for(size_t i=0,j=px-1;i<j;i++,j--){ uint8_t t0=buf[i*4+0],t1=buf[i*4+1],t2=buf[i*4+2],t3=buf[i*4+3];
@@ -519,26 +1261,152 @@ static inline void over_premul(uint8_t *dst, const uint8_t *src){
 static uint8_t* fb_rgba_alloc_clear(int fbw, int fbh){
     uint8_t *fb=(uint8_t*)calloc((size_t)fbw*fbh,4); if(!fb) die("calloc fb"); return fb;
 }
-static void blit_png_into_fb(uint8_t *fb,int fbw,int fbh,const uint8_t *src,int sw,int sh,int dstx,int dsty,int alpha,float scale){
+// Blit kernels -------------------------------------------------------------------
+// Inner loops are generated per variant and picked once per layer per frame;
+// clipping happens before the loops so they are straight runs over the FB.
+//
+// Image layers (FB coordinates): copy (opaque source) / over / over with a
+// global alpha, each 1:1 or scaled (nearest, column/row maps precomputed).
+typedef struct {
+    uint8_t *fb; int fbw;
+    const uint8_t *src; int sw;
+    int dstx, dsty;             // where source (0,0) lands
+    int x0, y0, x1, y1;         // clipped FB rect
+    const int *xmap, *ymap;     // scaled: FB offset from dstx/dsty -> source column/row
+    uint32_t ga;                // global alpha 1..254 (over_ga only)
+} BlitJob;
+typedef void (*BlitFn)(const BlitJob *j);
+
+static inline uint8_t mul255(uint32_t v, uint32_t a){ return (uint8_t)((v*a + 127)/255); }
+
+#define BLIT_VARIANTS(X) \
+    X(copy,    0,0,0) X(over,    1,0,0) X(over_ga,    1,1,0) \
+    X(copy_sc, 0,0,1) X(over_sc, 1,0,1) X(over_ga_sc, 1,1,1)
+#define BLIT_DEF(name, BLEND, GA, SCALED) \
+static void blit_##name(const BlitJob *j){ \
+    for(int y=j->y0;y<j->y1;y++){ \
+        int sy = SCALED? j->ymap[y-j->dsty] : y-j->dsty; \
+        const uint8_t *srow = j->src + 4*((size_t)sy*j->sw); \
+        uint8_t *d = j->fb + 4*((size_t)y*j->fbw + j->x0); \
+        if(!BLEND && !SCALED){ memcpy(d, srow+4*(j->x0-j->dstx), 4*(size_t)(j->x1-j->x0)); continue; } \
+        for(int x=j->x0;x<j->x1;x++,d+=4){ \
+            const uint8_t *s = srow + 4*(SCALED? j->xmap[x-j->dstx] : x-j->dstx); \
+            if(!BLEND){ memcpy(d,s,4); continue; } \
+            if(GA){ uint8_t p[4]={ mul255(s[0],j->ga), mul255(s[1],j->ga), mul255(s[2],j->ga), mul255(s[3],j->ga) }; over_premul(d,p); } \
+            else over_premul(d,s); \
+        } \
+    } \
+}
+BLIT_VARIANTS(BLIT_DEF)
+#undef BLIT_DEF
+static const BlitFn g_blit_fns[2][3]={ // [scaled][copy, over, over_ga]
+    { blit_copy, blit_over, blit_over_ga }, { blit_copy_sc, blit_over_sc, blit_over_ga_sc } };
+
+// Source column/row of every output pixel of a scaled blit (x map, then y
+// map). Kept by the caller, usually a draw op, and rebuilt only when the source
+// size or the scale changes.
+typedef struct { int *map; int sw, sh; float scale; } BlitMaps;
+static void blit_maps_free(BlitMaps *m){ free(m->map); memset(m,0,sizeof *m); }
+
+// alpha: -1/255 = as is, 0..254 = global opacity. opaque: every source pixel has a=255.
+// bm: maps for scaled blits (NULL: a shared one, render thread only). Returns
+// the number of FB pixels written.
+static size_t blit_png_into_fb(uint8_t *fb,int fbw,int fbh,const uint8_t *src,int sw,int sh,int dstx,int dsty,int alpha,float scale,int opaque,BlitMaps *bm){
     if(scale<=0.0f) scale=1.0f;
+    if(alpha==0) return 0;
+    int ga = alpha>=0 && alpha<255;
     int outw=(int)(sw*scale), outh=(int)(sh*scale);
-    for(int y=0;y<outh;y++){
-        int sy=(int)((y/scale)+0.5f); if(sy<0) sy=0; if(sy>=sh) sy=sh-1;
-        for(int x=0;x<outw;x++){
-            int sx=(int)((x/scale)+0.5f); if(sx<0) sx=0; if(sx>=sw) sx=sw-1;
-            int dx=dstx+x, dy=dsty+y;
-            if((unsigned)dx>=(unsigned)fbw || (unsigned)dy>=(unsigned)fbh) continue;
-            const uint8_t *s=src+4*(sy*sw+sx);
-            uint8_t sp[4]={s[0],s[1],s[2],s[3]};
-            if(alpha>=0 && alpha<255){
-                sp[0]=(uint8_t)((sp[0]*alpha + 127)/255);
-                sp[1]=(uint8_t)((sp[1]*alpha + 127)/255);
-                sp[2]=(uint8_t)((sp[2]*alpha + 127)/255);
-                sp[3]=(uint8_t)((sp[3]*alpha + 127)/255);
+    BlitJob j={ fb,fbw, src,sw, dstx,dsty, dstx<0?0:dstx, dsty<0?0:dsty, dstx+outw, dsty+outh, NULL,NULL, (uint32_t)(ga?alpha:255) };
+    if(j.x1>fbw) j.x1=fbw; if(j.y1>fbh) j.y1=fbh;
+    if(j.x0>=j.x1 || j.y0>=j.y1) return 0;
+    int scaled = scale!=1.0f;
+    if(scaled){
+        static BlitMaps shared;
+        if(!bm) bm=&shared;
+        if(!bm->map || bm->sw!=sw || bm->sh!=sh || bm->scale!=scale){
+            int *maps=(int*)realloc(bm->map,sizeof(int)*(size_t)(outw+outh)); if(!maps) die("realloc blit maps");
+            for(int x=0;x<outw;x++){ int sx=(int)((x/scale)+0.5f); maps[x]=sx<0?0:sx>=sw?sw-1:sx; }
+            for(int y=0;y<outh;y++){ int sy=(int)((y/scale)+0.5f); maps[outw+y]=sy<0?0:sy>=sh?sh-1:sy; }
+            bm->map=maps; bm->sw=sw; bm->sh=sh; bm->scale=scale;
+        }
+        j.xmap=bm->map; j.ymap=bm->map+outw;
+    }
+    g_blit_fns[scaled][ga? 2 : opaque? 0 : 1](&j);
+    return (size_t)(j.x1-j.x0)*(size_t)(j.y1-j.y0);
+}
+// Whether every pixel is opaque (lets layers take the copy kernel)
+static int rgba_opaque(const uint8_t *px, size_t n){
+    for(size_t i=0;i<n;i++) if(px[4*i+3]!=255) return 0;
+    return 1;
+}
+
+// Rotated sprites ------------------------------------------------------------------
+// An [image] with rotate_from= is turned about its pivot by an angle quantized
+// to rotate_step. Each (APNG frame, angle) is rendered once with bilinear
+// sampling and cropped to the pixels it covers; frames then only blit that box.
+// The cache holds rotate_cache entries per layer and drops the least recently
+// used one.
+typedef struct { int key, ox, oy, w, h; uint8_t *px; uint64_t used; } RotEntry; // ox/oy: box origin from the pivot pixel
+typedef struct { RotEntry *e; int n; uint64_t tick; size_t bytes; } RotCache;
+
+static RotEntry* rot_find(RotCache *c, int key){
+    for(int i=0;i<c->n;i++) if(c->e[i].key==key){ c->e[i].used=++c->tick; return &c->e[i]; }
+    return NULL;
+}
+static RotEntry* rot_slot(RotCache *c, int max){
+    if(!c->e && !(c->e=(RotEntry*)calloc((size_t)max,sizeof(RotEntry)))) die("calloc rotation cache");
+    RotEntry *e=&c->e[c->n<max? c->n++ : 0];
+    if(e->px) for(int i=1;i<c->n;i++) if(c->e[i].used<e->used) e=&c->e[i];
+    c->bytes-=(size_t)e->w*e->h*4; free(e->px); memset(e,0,sizeof *e);
+    e->used=++c->tick; return e;
+}
+static int rot_same(const RotSpec *a, const RotSpec *b){
+    return a->v0==b->v0 && a->v1==b->v1 && a->a0==b->a0 && a->a1==b->a1 && a->step==b->step && a->cache==b->cache &&
+           (a->pvx==b->pvx || (isnan(a->pvx) && isnan(b->pvx))) && (a->pvy==b->pvy || (isnan(a->pvy) && isnan(b->pvy)));
+}
+static void rot_free(RotCache *c){
+    for(int i=0;i<c->n;i++) free(c->e[i].px);
+    free(c->e); memset(c,0,sizeof *c);
+}
+// Renders src (premultiplied, sw x sh) scaled and turned deg clockwise about
+// (pvx,pvy) in source pixels. The pivot lands at frx,fry inside its FB pixel.
+static void rot_render(RotEntry *e, const uint8_t *src, int sw, int sh, double deg, double scale,
+                       double pvx, double pvy, double frx, double fry){
+    double r=deg*M_PI/180.0, c=cos(r), s=sin(r), minx=1e9, miny=1e9, maxx=-1e9, maxy=-1e9;
+    for(int k=0;k<4;k++){
+        double dx=((k&1)? sw : 0)-pvx, dy=((k&2)? sh : 0)-pvy;
+        double X=frx+(dx*c-dy*s)*scale, Y=fry+(dx*s+dy*c)*scale;
+        if(X<minx) minx=X; if(X>maxx) maxx=X; if(Y<miny) miny=Y; if(Y>maxy) maxy=Y;
+    }
+    int x0=(int)floor(minx)-1, y0=(int)floor(miny)-1, bw=(int)ceil(maxx)+1-x0, bh=(int)ceil(maxy)+1-y0;
+    uint8_t *buf=(uint8_t*)calloc((size_t)bw*bh,4); if(!buf) die("calloc rotated sprite");
+    int cx0=bw, cy0=bh, cx1=0, cy1=0; // covered box
+    for(int y=0;y<bh;y++){
+        for(int x=0;x<bw;x++){
+            // inverse map of the pixel centre, in source pixels
+            double X=x0+x+0.5-frx, Y=y0+y+0.5-fry;
+            double u=(X*c+Y*s)/scale+pvx-0.5, v=(-X*s+Y*c)/scale+pvy-0.5;
+            if(u<=-1 || v<=-1 || u>=sw || v>=sh) continue;
+            int iu=(int)floor(u), iv=(int)floor(v);
+            uint32_t fu=(uint32_t)((u-iu)*256+0.5), fv=(uint32_t)((v-iv)*256+0.5), acc[4]={0,0,0,0};
+            for(int t=0;t<4;t++){
+                int su=iu+(t&1), sv=iv+(t>>1);
+                if(su<0 || sv<0 || su>=sw || sv>=sh) continue;
+                uint32_t wgt=((t&1)? fu : 256-fu)*((t>>1)? fv : 256-fv);
+                const uint8_t *p=src+4*((size_t)sv*sw+su);
+                for(int ch=0;ch<4;ch++) acc[ch]+=p[ch]*wgt;
             }
-            over_premul(fb + 4*(dy*fbw + dx), sp);
+            if(acc[3]<32768) continue; // rounds to transparent
+            uint8_t *d=buf+4*((size_t)y*bw+x);
+            for(int ch=0;ch<4;ch++) d[ch]=(uint8_t)((acc[ch]+32768)>>16);
+            if(x<cx0) cx0=x; if(x>=cx1) cx1=x+1; if(y<cy0) cy0=y; if(y>=cy1) cy1=y+1;
         }
     }
+    if(cx0>=cx1){ cx0=cy0=0; cx1=cy1=1; } // nothing visible: a 1x1 transparent box
+    e->ox=x0+cx0; e->oy=y0+cy0; e->w=cx1-cx0; e->h=cy1-cy0;
+    if(!(e->px=(uint8_t*)malloc((size_t)e->w*e->h*4))) die("malloc rotated sprite");
+    for(int y=0;y<e->h;y++) memcpy(e->px+(size_t)y*e->w*4, buf+4*((size_t)(cy0+y)*bw+cx0), (size_t)e->w*4);
+    free(buf);
 }
 
 // UI mapping (portrait/landscape + flip) ----------------------------------------
@@ -552,40 +1420,215 @@ static inline void map_ui_xy_fb(int xL,int yL, UiOrient o,int flip180, int *dx,i
     if(flip180){ mx=W-1-mx; my=H-1-my; }
     int ox=(fbw-W)/2, oy=(fbh-H)/2; *dx=ox+mx; *dy=oy+my;
 }
-static inline void put_px_ui(uint8_t *fb,int fbw,int fbh,int xL,int yL,UiOrient o,int flip180,uint8_t r,uint8_t g,uint8_t b,uint8_t a,const Layout *L){
-    int dx,dy; map_ui_xy_fb(xL,yL,o,flip180,&dx,&dy,fbw,fbh,L);
-    if((unsigned)dx>=(unsigned)fbw||(unsigned)dy>=(unsigned)fbh) return;
-    uint8_t p[4]; p[3]=a; p[0]=(uint8_t)((r*a+127)/255); p[1]=(uint8_t)((g*a+127)/255); p[2]=(uint8_t)((b*a+127)/255);
-    over_premul(fb+4*(dy*fbw+dx),p);
+// UI layers (overlays, text) are drawn in layout coordinates. The mapping above
+// is fb = b + M*(xL,yL) with M one of 4 rotations (CCW is CW turned 180°, so
+// flips only move b); each gets its own kernels (portrait writes contiguous
+// rows) for a solid fill (opaque store / over) and a coverage mask (glyphs).
+typedef struct {
+    uint8_t *fb; int fbw;
+    int bx, by;                 // FB position of layout (0,0)
+    int x0, y0, x1, y1;         // clipped layout rect
+    uint8_t px[4];              // fill: premultiplied colour
+    uint8_t r, g, b; uint32_t a;// mask: colour and alpha scaled by coverage
+    const uint8_t *mask; int mstride, mx, my; // mask origin in layout coords
+} UiJob;
+typedef void (*UiFn)(const UiJob *j);
+// name, fb dx per xL, dx per yL, dy per xL, dy per yL
+#define UI_ORIENTS(X) \
+    X(r0,    1, 0, 0, 1) X(r180, -1, 0, 0,-1) \
+    X(cw,    0, 1,-1, 0) X(ccw,   0,-1, 1, 0)
+#define UI_DEF(name, AX, AY, CX, CY) \
+static void ui_fill_##name(const UiJob *j){ \
+    ptrdiff_t step = 4*((ptrdiff_t)AX + (ptrdiff_t)CX*j->fbw); \
+    for(int y=j->y0;y<j->y1;y++){ \
+        uint8_t *d = j->fb + 4*((ptrdiff_t)(j->by + CX*j->x0 + CY*y)*j->fbw + j->bx + AX*j->x0 + AY*y); \
+        for(int x=j->x0;x<j->x1;x++,d+=step) over_premul(d,j->px); \
+    } \
+} \
+static void ui_store_##name(const UiJob *j){ \
+    ptrdiff_t step = 4*((ptrdiff_t)AX + (ptrdiff_t)CX*j->fbw); \
+    for(int y=j->y0;y<j->y1;y++){ \
+        uint8_t *d = j->fb + 4*((ptrdiff_t)(j->by + CX*j->x0 + CY*y)*j->fbw + j->bx + AX*j->x0 + AY*y); \
+        for(int x=j->x0;x<j->x1;x++,d+=step) memcpy(d,j->px,4); \
+    } \
+} \
+static void ui_mask_##name(const UiJob *j){ \
+    ptrdiff_t step = 4*((ptrdiff_t)AX + (ptrdiff_t)CX*j->fbw); \
+    for(int y=j->y0;y<j->y1;y++){ \
+        uint8_t *d = j->fb + 4*((ptrdiff_t)(j->by + CX*j->x0 + CY*y)*j->fbw + j->bx + AX*j->x0 + AY*y); \
+        const uint8_t *m = j->mask + (size_t)(y-j->my)*j->mstride + (j->x0-j->mx); \
+        for(int x=j->x0;x<j->x1;x++,d+=step,m++){ \
+            uint32_t A=(*m*j->a+127)/255; \
+            uint8_t p[4]={ mul255(j->r,A), mul255(j->g,A), mul255(j->b,A), (uint8_t)A }; \
+            over_premul(d,p); \
+        } \
+    } \
 }
-static void draw_overlay_ui(uint8_t *fb,int fbw,int fbh,Overlay ov, UiOrient o,int flip180,const Layout *L){
-    int LW=(o==ORIENT_PORTRAIT)?W:H, LH=(o==ORIENT_PORTRAIT)?H:W;
-    int x0=ov.x<0?0:ov.x, y0=ov.y<0?0:ov.y, x1=ov.x+ov.w, y1=ov.y+ov.h;
-    if(x1>LW)x1=LW; if(y1>LH)y1=LH;
-    for(int y=y0;y<y1;y++) for(int x=x0;x<x1;x++) put_px_ui(fb,fbw,fbh,x,y,o,flip180,ov.r,ov.g,ov.b,ov.a,L);
+UI_ORIENTS(UI_DEF)
+#undef UI_DEF
+typedef struct { int ax, ay, cx, cy; UiFn fill, store, mask; } UiKernels;
+#define UI_ENTRY(name, AX, AY, CX, CY) { AX, AY, CX, CY, ui_fill_##name, ui_store_##name, ui_mask_##name },
+static const UiKernels g_ui_kernels[]={ UI_ORIENTS(UI_ENTRY) };
+#undef UI_ENTRY
+
+// Resolved mapping for one orientation/flip: kernels, origin and the layout
+// rect that lands inside the FB
+typedef struct { const UiKernels *k; int bx, by; int cx0, cy0, cx1, cy1; } UiXform;
+static void ui_xform(UiXform *t, UiOrient o, int flip180, int ccw, int fbw, int fbh, const Layout *L){
+    Layout Lloc=*L; Lloc.text_landscape_ccw=ccw;
+    int x00,y00,x10,y10,x01,y01;
+    map_ui_xy_fb(0,0,o,flip180,&x00,&y00,fbw,fbh,&Lloc);
+    map_ui_xy_fb(1,0,o,flip180,&x10,&y10,fbw,fbh,&Lloc);
+    map_ui_xy_fb(0,1,o,flip180,&x01,&y01,fbw,fbh,&Lloc);
+    int ax=x10-x00, cx=y10-y00, ay=x01-x00, cy=y01-y00;
+    t->k=&g_ui_kernels[0];
+    for(size_t i=0;i<sizeof g_ui_kernels/sizeof g_ui_kernels[0];i++){
+        const UiKernels *k=&g_ui_kernels[i];
+        if(k->ax==ax && k->ay==ay && k->cx==cx && k->cy==cy){ t->k=k; break; }
+    }
+    t->bx=x00; t->by=y00;
+    // inverse of an axis permutation is its transpose
+    int lx_a = ax*(0-x00)+cx*(0-y00),        ly_a = ay*(0-x00)+cy*(0-y00);
+    int lx_b = ax*(fbw-1-x00)+cx*(fbh-1-y00), ly_b = ay*(fbw-1-x00)+cy*(fbh-1-y00);
+    t->cx0 = lx_a<lx_b? lx_a : lx_b; t->cx1 = (lx_a<lx_b? lx_b : lx_a)+1;
+    t->cy0 = ly_a<ly_b? ly_a : ly_b; t->cy1 = (ly_a<ly_b? ly_b : ly_a)+1;
+}
+// Clips [x0,x1)x[y0,y1) (layout) to the FB; 0 if nothing is left
+static int ui_clip(const UiXform *t, UiJob *j, uint8_t *fb, int fbw, int x0, int y0, int x1, int y1){
+    if(x0<t->cx0) x0=t->cx0; if(y0<t->cy0) y0=t->cy0; if(x1>t->cx1) x1=t->cx1; if(y1>t->cy1) y1=t->cy1;
+    if(x0>=x1 || y0>=y1) return 0;
+    j->fb=fb; j->fbw=fbw; j->bx=t->bx; j->by=t->by; j->x0=x0; j->y0=y0; j->x1=x1; j->y1=y1;
+    return 1;
 }
 
 // TTF cache & draw ---------------------------------------------------------------
+// One entry per font file and pixel size. Glyphs are rasterized once into the
+// entry (printable ASCII when the font is loaded, anything else the first time
+// it is drawn) and text is drawn from there as 8-bit coverage. A .bdf file is
+// a bitmap font at its own size; its glyphs go into the same cache as 0/255.
+typedef struct { int cp, gi, x0, y0, w, h, adv; uint8_t *bmp; } Glyph; // x0/y0: box from the pen on the baseline
 typedef struct {
-    char path[512]; int px; int valid;
-    unsigned char *ttf_data; size_t ttf_size;
+    char path[512]; int px;
+    unsigned char *ttf_data; size_t ttf_size;   // NULL for BDF
     stbtt_fontinfo info; float scale; int ascent,descent,lineGap;
+    int asc_px, line_px;                        // baseline below the text's top, line advance
+    Glyph *g; int n_g, cap_g; int ascii[128];   // ascii: index+1 into g (0 = not cached yet)
+    int fallback;                               // BDF: index+1 of DEFAULT_CHAR or '?' for missing glyphs
+    size_t glyph_bytes;
 } TtfCache;
-static TtfCache g_ttf_cache[4];
-
+// Entries never move or get evicted: display lists keep pointers to them
+static TtfCache **g_ttf_cache; static int g_n_ttf;
+
+static int font_is_bdf(const char *path){ size_t n=strlen(path); return n>4 && !strcasecmp(path+n-4,".bdf"); }
+static const Glyph* font_add_glyph(TtfCache *c, const Glyph *G){
+    if(c->n_g==c->cap_g){ c->cap_g=c->cap_g?c->cap_g*2:128; c->g=(Glyph*)realloc(c->g,(size_t)c->cap_g*sizeof(Glyph)); if(!c->g) die("realloc glyphs"); }
+    c->g[c->n_g++]=*G; c->glyph_bytes+=(size_t)G->w*G->h;
+    if(G->cp>=0 && G->cp<128) c->ascii[G->cp]=c->n_g;
+    return &c->g[c->n_g-1];
+}
+static int font_has(const TtfCache *c, int cp){
+    if(c->ttf_data) return stbtt_FindGlyphIndex(&c->info,cp)!=0;
+    for(int i=0;i<c->n_g;i++) if(c->g[i].cp==cp) return 1;
+    return 0;
+}
+// Cached glyph for cp (rasterized now if new); NULL if a BDF font has none.
+// The pointer is valid until the next glyph is added.
+static const Glyph* font_glyph(TtfCache *c, int cp){
+    if(cp>=0 && cp<128){ if(c->ascii[cp]) return &c->g[c->ascii[cp]-1]; }
+    else for(int i=0;i<c->n_g;i++) if(c->g[i].cp==cp) return &c->g[i];
+    if(!c->ttf_data) return c->fallback? &c->g[c->fallback-1] : NULL;
+    Glyph G={ cp, stbtt_FindGlyphIndex(&c->info,cp), 0,0,0,0,0, NULL }; int ax,lsb,x1,y1;
+    stbtt_GetGlyphHMetrics(&c->info,G.gi,&ax,&lsb); G.adv=(int)(ax*c->scale+0.5f);
+    stbtt_GetGlyphBitmapBox(&c->info,G.gi,c->scale,c->scale,&G.x0,&G.y0,&x1,&y1);
+    G.w=x1-G.x0; G.h=y1-G.y0;
+    if(G.w>0 && G.h>0){
+        if(!(G.bmp=(uint8_t*)malloc((size_t)G.w*G.h))) die("malloc glyph");
+        stbtt_MakeGlyphBitmap(&c->info,G.bmp,G.w,G.h,G.w,c->scale,c->scale,G.gi);
+    } else G.w=G.h=0;
+    return font_add_glyph(c,&G);
+}
+static int font_kern(const TtfCache *c, int gi1, int gi2){
+    return c->ttf_data? (int)(stbtt_GetGlyphKernAdvance(&c->info,gi1,gi2)*c->scale+0.5f) : 0;
+}
+static TtfCache* font_new(const char *path, int px){
+    TtfCache *c=(TtfCache*)calloc(1,sizeof *c); if(!c) die("calloc ttf");
+    snprintf(c->path,sizeof c->path,"%s",path); c->px=px; return c;
+}
+static void font_free(TtfCache *c){
+    for(int i=0;i<c->n_g;i++) free(c->g[i].bmp);
+    free(c->g); free(c->ttf_data); free(c);
+}
+// BDF glyphs that have an ENCODING; BBX and DWIDTH per glyph, bitmap rows in hex
+static TtfCache* bdf_load(const char *path){
+    FILE *f=fopen(path,"r"); if(!f){ fprintf(stderr,"bdf open failed: %s\n",path); return NULL; }
+    TtfCache *c=font_new(path,0); Glyph G; memset(&G,0,sizeof G);
+    char line[1024]; int asc=-1, desc=0, defch=-1, in_bm=0, row=0;
+    while(fgets(line,sizeof line,f)){
+        if(in_bm && strncmp(line,"STARTCHAR",9)){ // STARTCHAR: the last glyph had no ENDCHAR
+            if(strncmp(line,"ENDCHAR",7)){
+                size_t nd=strlen(line); // a short row is padded with zero bits
+                for(int x=0;x<G.w && row<G.h;x++){
+                    char ch=(size_t)(x>>2)<nd? line[x>>2] : 0; int nib = isxdigit((unsigned char)ch)? (isdigit((unsigned char)ch)? ch-'0' : (tolower(ch)-'a'+10)) : 0;
+                    G.bmp[(size_t)row*G.w+x] = (nib>>(3-(x&3)))&1? 255 : 0;
+                }
+                row++; continue;
+            }
+            in_bm=0;
+            if(G.cp>=0) font_add_glyph(c,&G); else free(G.bmp);
+            memset(&G,0,sizeof G);
+        }
+        else if(!strncmp(line,"FONT_ASCENT ",12)) asc=atoi(line+12);
+        else if(!strncmp(line,"FONT_DESCENT ",13)) desc=atoi(line+13);
+        else if(!strncmp(line,"DEFAULT_CHAR ",13)) defch=atoi(line+13);
+        else if(!strncmp(line,"STARTCHAR",9)){ free(G.bmp); memset(&G,0,sizeof G); G.cp=-1; in_bm=0; }
+        else if(!strncmp(line,"ENCODING ",9)) G.cp=atoi(line+9);
+        else if(!strncmp(line,"DWIDTH ",7)) G.adv=atoi(line+7);
+        else if(!strncmp(line,"BBX ",4)){
+            // wider than a row of hex digits fits in line: no bitmap, only the advance
+            int w,h,xo,yo, wmax=4*((int)sizeof line-2);
+            if(sscanf(line+4,"%d %d %d %d",&w,&h,&xo,&yo)==4 && w>=0 && h>=0){
+                if(w>wmax || h>wmax){ fprintf(stderr,"bdf: BBX %dx%d too big in %s\n",w,h,path); w=h=0; }
+                G.w=w; G.h=h; G.x0=xo; G.y0=-(yo+h);
+            }
+        }
+        else if(!strncmp(line,"BITMAP",6)){
+            in_bm=1; row=0; free(G.bmp); G.bmp=NULL;
+            if(G.w>0 && G.h>0){ if(!(G.bmp=(uint8_t*)calloc((size_t)G.w*G.h,1))) die("calloc bdf glyph"); } else G.w=G.h=0;
+        }
+    }
+    fclose(f); free(G.bmp);
+    if(asc<0 || !c->n_g){ fprintf(stderr,"bdf: no FONT_ASCENT or glyphs in %s\n",path); font_free(c); return NULL; }
+    c->asc_px=asc; c->line_px=asc+desc; c->px=asc+desc;
+    for(int i=0;i<c->n_g && !c->fallback;i++) if(c->g[i].cp==defch) c->fallback=i+1;
+    for(int i=0;i<c->n_g && !c->fallback;i++) if(c->g[i].cp=='?') c->fallback=i+1;
+    return c;
+}
+// px is ignored for BDF fonts (one entry per file at its own size)
 static TtfCache* ttf_get(const char *path, int px){
-    if(!path||px<=0) return NULL;
-    for(int i=0;i<4;i++) if(g_ttf_cache[i].valid && g_ttf_cache[i].px==px && !strcmp(g_ttf_cache[i].path,path)) return &g_ttf_cache[i];
-    int slot=-1; for(int i=0;i<4;i++) if(!g_ttf_cache[i].valid){ slot=i; break; } if(slot<0) slot=0;
-    FILE *f=fopen(path,"rb"); if(!f){ fprintf(stderr,"ttf open failed: %s\n",path); return NULL; }
-    fseek(f,0,SEEK_END); long sz=ftell(f); fseek(f,0,SEEK_SET); if(sz<=0){ fclose(f); fprintf(stderr,"ttf size invalid: %s\n",path); return NULL; }
-    unsigned char *data=(unsigned char*)malloc((size_t)sz); if(!data){ fclose(f); fprintf(stderr,"ttf malloc failed\n"); return NULL; }
-    if(fread(data,1,(size_t)sz,f)!=(size_t)sz){ fclose(f); free(data); fprintf(stderr,"ttf read failed\n"); return NULL; } fclose(f);
-    stbtt_fontinfo info; if(!stbtt_InitFont(&info,data,stbtt_GetFontOffsetForIndex(data,0))){ free(data); fprintf(stderr,"ttf init failed: %s\n",path); return NULL; }
-    float scale=stbtt_ScaleForPixelHeight(&info,(float)px); int a,d,lg; stbtt_GetFontVMetrics(&info,&a,&d,&lg);
-    TtfCache *c=&g_ttf_cache[slot]; if(c->valid && c->ttf_data) free(c->ttf_data); memset(c,0,sizeof *c);
-    strncpy(c->path,path,sizeof(c->path)-1); c->px=px; c->ttf_data=data; c->ttf_size=(size_t)sz; c->info=info;
-    c->scale=scale; c->ascent=a; c->descent=d; c->lineGap=lg; c->valid=1; return c;
+    if(!path) return NULL;
+    int bdf=font_is_bdf(path);
+    if(!bdf && px<=0) return NULL;
+    for(int i=0;i<g_n_ttf;i++) if((bdf || g_ttf_cache[i]->px==px) && !strcmp(g_ttf_cache[i]->path,path)) return g_ttf_cache[i];
+    TtfCache *c;
+    if(bdf){ if(!(c=bdf_load(path))) return NULL; }
+    else {
+        FILE *f=fopen(path,"rb"); if(!f){ fprintf(stderr,"ttf open failed: %s\n",path); return NULL; }
+        fseek(f,0,SEEK_END); long sz=ftell(f); fseek(f,0,SEEK_SET); if(sz<=0){ fclose(f); fprintf(stderr,"ttf size invalid: %s\n",path); return NULL; }
+        unsigned char *data=(unsigned char*)malloc((size_t)sz); if(!data){ fclose(f); fprintf(stderr,"ttf malloc failed\n"); return NULL; }
+        if(fread(data,1,(size_t)sz,f)!=(size_t)sz){ fclose(f); free(data); fprintf(stderr,"ttf read failed\n"); return NULL; } fclose(f);
+        stbtt_fontinfo info; if(!stbtt_InitFont(&info,data,stbtt_GetFontOffsetForIndex(data,0))){ free(data); fprintf(stderr,"ttf init failed: %s\n",path); return NULL; }
+        float scale=stbtt_ScaleForPixelHeight(&info,(float)px); int a,d,lg; stbtt_GetFontVMetrics(&info,&a,&d,&lg);
+        c=font_new(path,px); c->ttf_data=data; c->ttf_size=(size_t)sz; c->info=info;
+        c->scale=scale; c->ascent=a; c->descent=d; c->lineGap=lg;
+        c->asc_px=(int)(a*scale+0.5f); c->line_px=(int)((a-d+lg)*scale+0.5f);
+        for(int cp=32;cp<127;cp++) font_glyph(c,cp); // bake printable ASCII
+    }
+    g_ttf_cache=(TtfCache**)realloc(g_ttf_cache,(g_n_ttf+1)*sizeof(TtfCache*)); if(!g_ttf_cache) die("realloc ttf"); g_ttf_cache[g_n_ttf++]=c;
+    return c;
+}
+static void ttf_free_all(void){
+    for(int i=0;i<g_n_ttf;i++) font_free(g_ttf_cache[i]);
+    free(g_ttf_cache); g_ttf_cache=NULL; g_n_ttf=0;
 }
 static const unsigned char* utf8_next(const unsigned char *s, int *cp){
     unsigned c0=s[0]; if(c0<0x80){ *cp=(int)c0; return s+1; }
@@ -594,52 +1637,180 @@ static const unsigned char* utf8_next(const unsigned char *s, int *cp){
     if((c0&0xF8)==0xF0){ unsigned c1=s[1],c2=s[2],c3=s[3]; if((c1&0xC0)!=0x80||(c2&0xC0)!=0x80||(c3&0xC0)!=0x80) goto bad; unsigned v=((c0&0x07)<<18)|((c1&0x3F)<<12)|((c2&0x3F)<<6)|((c3&0x3F)); if(v<0x10000||v>0x10FFFF) goto bad; *cp=(int)v; return s+4; }
 bad: *cp=0xFFFD; return s+1;
 }
-static void draw_text_ttf(uint8_t *fb,int fbw,int fbh,const TextItem *ti, UiOrient global_o,int global_flip,const Layout *L,const Metrics *M){
-    const char *path = ti->ttf_path ? ti->ttf_path : (L->default_ttf[0]? L->default_ttf : NULL);
-    int px = ti->ttf_px>0 ? ti->ttf_px : (L->default_ttf_px>0 ? L->default_ttf_px : 0);
-    if(!path||px<=0){ fprintf(stderr,"[text] missing TTF/size; skipping \"%s\"\n", ti->text?ti->text:""); return; }
-    TtfCache *fc=ttf_get(path,px); if(!fc) return;
-
-    UiOrient o=global_o; int flip=global_flip; int ccw=L->text_landscape_ccw;
-    if(ti->orient_override!=-1) o=(ti->orient_override==1)?ORIENT_LANDSCAPE:ORIENT_PORTRAIT;
-    if(ti->flip_override!=-1) flip=ti->flip_override;
-    if(ti->landscape_ccw_override!=-1) ccw=ti->landscape_ccw_override;
-    Layout Lloc=*L; Lloc.text_landscape_ccw=ccw;
+// Per-layer counters (--analyze)
+typedef struct { uint64_t px, glyphs, us, frames; } OpStats;
+// Draws n bytes of UTF-8 as one line with the pen at (x, baseline), clipped to
+// clip (layout x0,y0,x1,y1) if given; returns the pen position after it
+static int draw_glyphs(uint8_t *fb,int fbw,const UiXform *t,TtfCache *fc,const char *s,int n,int x,int baseline,
+                       uint8_t r,uint8_t g,uint8_t b,uint8_t a,const int *clip,OpStats *st){
+    const unsigned char *p=(const unsigned char*)s, *e=p+n; int prev=-1;
+    while(p<e){
+        int cp=0; p=utf8_next(p,&cp);
+        const Glyph *G=font_glyph(fc,cp); if(!G) continue;
+        if(prev>=0) x+=font_kern(fc,prev,G->gi);
+        int gx=x+G->x0, gy=baseline+G->y0, x0=gx, y0=gy, x1=gx+G->w, y1=gy+G->h; UiJob j;
+        if(clip){ if(x0<clip[0]) x0=clip[0]; if(y0<clip[1]) y0=clip[1]; if(x1>clip[2]) x1=clip[2]; if(y1>clip[3]) y1=clip[3]; }
+        if(G->bmp && x0<x1 && y0<y1 && ui_clip(t,&j,fb,fbw,x0,y0,x1,y1)){
+            j.mask=G->bmp; j.mstride=G->w; j.mx=gx; j.my=gy;
+            j.r=r; j.g=g; j.b=b; j.a=a;
+            t->k->mask(&j);
+            if(st){ st->glyphs++; st->px+=(uint64_t)(j.x1-j.x0)*(j.y1-j.y0); }
+        }
+        x+=G->adv; prev=G->gi;
+    }
+    return x;
+}
+// Draws UTF-8 text with its top-left at layout (tx,ty) through mapping t
+static void draw_text_run(uint8_t *fb,int fbw,const UiXform *t,TtfCache *fc,const char *buf,int tx,int ty,uint8_t r,uint8_t g,uint8_t b,uint8_t a,OpStats *st){
+    for(int baseline=ty+fc->asc_px;;baseline+=fc->line_px){
+        const char *nl=strchr(buf,'\n'); int n=nl? (int)(nl-buf) : (int)strlen(buf);
+        draw_glyphs(fb,fbw,t,fc,buf,n,tx,baseline,r,g,b,a,NULL,st);
+        if(!nl) break;
+        buf=nl+1;
+    }
+}
+// Marquee: a scrolling [text] is rendered once as one line into a coverage
+// strip one period (advance + gap) wide, again only when its expanded text
+// changes. Each frame samples a window of the strip at a 1/256 px offset
+// (wrapping) and draws it with the mask kernel like a single glyph.
+typedef struct {
+    uint8_t *strip, *win;       // w x h coverage; window scroll_w x h
+    int w, h, y0, adv;          // y0: strip top below the text's y
+    char *text;                 // what the strip shows
+    uint32_t pos;               // offset into the strip, 24.8 (set per frame)
+} Marquee;
+static void mq_free(Marquee *q){ free(q->strip); free(q->win); free(q->text); memset(q,0,sizeof *q); }
+static void mq_render(Marquee *q, TtfCache *fc, const char *s, int gap){
+    int asc=fc->asc_px, x=0, prev=-1, y0=0, y1=1;
+    for(const unsigned char *p=(const unsigned char*)s; *p; ){ // extent
+        int cp; p=utf8_next(p,&cp); if(cp=='\n') cp=' ';
+        const Glyph *G=font_glyph(fc,cp); if(!G) continue;
+        if(prev>=0) x+=font_kern(fc,prev,G->gi);
+        if(G->bmp){ if(asc+G->y0<y0) y0=asc+G->y0; if(asc+G->y0+G->h>y1) y1=asc+G->y0+G->h; }
+        x+=G->adv; prev=G->gi;
+    }
+    free(q->strip); free(q->text); free(q->win); q->win=NULL;
+    q->adv=x; q->w=x+gap>0? x+gap : 1; q->h=y1-y0; q->y0=y0;
+    q->strip=(uint8_t*)calloc((size_t)q->w*q->h,1); q->text=strdup(s);
+    if(!q->strip || !q->text) die("marquee strip");
+    x=0; prev=-1;
+    for(const unsigned char *p=(const unsigned char*)s; *p; ){
+        int cp; p=utf8_next(p,&cp); if(cp=='\n') cp=' ';
+        const Glyph *G=font_glyph(fc,cp); if(!G) continue;
+        if(prev>=0) x+=font_kern(fc,prev,G->gi);
+        for(int yy=0;yy<G->h;yy++){
+            uint8_t *row=q->strip+(size_t)(asc+G->y0+yy-q->y0)*q->w; const uint8_t *m=G->bmp+(size_t)yy*G->w;
+            for(int xx=0;xx<G->w;xx++){ int c=((x+G->x0+xx)%q->w+q->w)%q->w, v=row[c]+m[xx]; row[c]=(uint8_t)(v>255?255:v); }
+        }
+        x+=G->adv; prev=G->gi;
+    }
+}
+// Draws the window at layout (tx,ty), ww px wide
+static void mq_draw(Marquee *q, uint8_t *fb, int fbw, const UiXform *t, int tx, int ty, int ww,
+                    uint8_t r, uint8_t g, uint8_t b, uint8_t a, OpStats *st){
+    UiJob j;
+    if(!ui_clip(t,&j,fb,fbw,tx,ty+q->y0,tx+ww,ty+q->y0+q->h)) return;
+    if(!q->win && !(q->win=(uint8_t*)malloc((size_t)ww*q->h))) die("malloc marquee window");
+    uint32_t f=q->pos&255; int c0=(int)(q->pos>>8)%q->w;
+    for(int y=0;y<q->h;y++){
+        const uint8_t *row=q->strip+(size_t)y*q->w; uint8_t *d=q->win+(size_t)y*ww;
+        for(int x=0,c=c0;x<ww;x++){
+            int c1=c+1==q->w? 0 : c+1;
+            d[x]=(uint8_t)((row[c]*(256-f)+row[c1]*f+128)>>8);
+            c=c1;
+        }
+    }
+    j.mask=q->win; j.mstride=ww; j.mx=tx; j.my=ty+q->y0;
+    j.r=r; j.g=g; j.b=b; j.a=a;
+    t->k->mask(&j);
+    if(st) st->px+=(uint64_t)(j.x1-j.x0)*(j.y1-j.y0);
+}
 
-    char buf[1024]; expand_tokens(buf,sizeof buf, ti->text?ti->text:"", M);
-    float scale=fc->scale; int x=ti->x; int baseline=ti->y + (int)(fc->ascent*scale+0.5f);
-    int line_adv=(int)((fc->ascent - fc->descent + fc->lineGap)*scale + 0.5f); int prev=0;
-
-    const unsigned char *p=(const unsigned char*)buf;
-    while(*p){
-        int cp=0; const unsigned char *np=utf8_next(p,&cp);
-        if(cp=='\n'){ x=ti->x; baseline+=line_adv; prev=0; p=np; continue; }
-        int ax,lsb; int kern=0; if(prev){ kern=stbtt_GetCodepointKernAdvance(&fc->info,prev,cp); x+=(int)(kern*scale+0.5f); }
-        stbtt_GetCodepointHMetrics(&fc->info,cp,&ax,&lsb);
-        int x0,y0,x1,y1; stbtt_GetCodepointBitmapBox(&fc->info,cp,scale,scale,&x0,&y0,&x1,&y1);
-        int gw=x1-x0, gh=y1-y0;
-        if(gw>0 && gh>0){
-            unsigned char *bmp=(unsigned char*)malloc((size_t)gw*gh);
-            if(bmp){
-                stbtt_MakeCodepointBitmap(&fc->info,bmp,gw,gh,gw,scale,scale,cp);
-                for(int by=0;by<gh;by++)for(int bx=0;bx<gw;bx++){
-                    int a8=bmp[by*gw+bx]; if(!a8) continue; int A=(a8*ti->a+127)/255;
-                    put_px_ui(fb,fbw,fbh, x+x0+bx, baseline+y0+by, o,flip, ti->r,ti->g,ti->b,(uint8_t)A,&Lloc);
-                }
-                free(bmp);
+// Text boxes: a [text] with width/height/max_lines is broken into lines (at
+// spaces, or anywhere in a word longer than the width) and cut with an
+// ellipsis when it needs more lines than fit. Breaks and widths are kept per
+// expanded string and redone only when it changes.
+typedef struct { int off, len, w; } TextLine;
+typedef struct {
+    char *text;                 // what the lines were computed for
+    TextLine *line; int n, cap;
+    int cut;                    // the last line is followed by the ellipsis
+    const char *ell; int ell_w;
+} TextBox;
+static void tb_free(TextBox *b){ free(b->text); free(b->line); memset(b,0,sizeof *b); }
+// Pen advance over n bytes of s (kerning inside the run)
+static int text_width(TtfCache *fc, const char *s, int n){
+    int x=0, prev=-1; const unsigned char *p=(const unsigned char*)s, *e=p+n;
+    while(p<e){ int cp; p=utf8_next(p,&cp); const Glyph *G=font_glyph(fc,cp); if(!G) continue;
+        if(prev>=0) x+=font_kern(fc,prev,G->gi); x+=G->adv; prev=G->gi; }
+    return x;
+}
+static void tb_push(TextBox *b, int off, int len, int w){
+    if(b->n==b->cap){ b->cap=b->cap?b->cap*2:8; b->line=(TextLine*)realloc(b->line,(size_t)b->cap*sizeof(TextLine)); if(!b->line) die("realloc text lines"); }
+    b->line[b->n++]=(TextLine){ off, len, w };
+}
+static void tb_layout(TextBox *b, TtfCache *fc, const char *s, int width, int max_lines, const char *ell){
+    free(b->text); if(!(b->text=strdup(s))) die("strdup text");
+    b->n=0; b->cut=0; b->ell=ell; b->ell_w=text_width(fc,ell,(int)strlen(ell));
+    for(const char *p=s;;){
+        const char *pe=strchr(p,'\n'); if(!pe) pe=p+strlen(p);
+        const char *ls=p;
+        do {
+            // longest run from ls that fits, preferring to end before a space
+            int x=0, prev=-1, brk_w=0; const char *q=ls, *brk=NULL, *fit=ls; int fit_w=0;
+            while(q<pe){
+                int cp; const char *nq=(const char*)utf8_next((const unsigned char*)q,&cp);
+                const Glyph *G=font_glyph(fc,cp);
+                int nx = G? x+(prev>=0? font_kern(fc,prev,G->gi) : 0)+G->adv : x;
+                if(width>0 && nx>width && cp!=' ') break;
+                if(cp==' '){ brk=q; brk_w=x; }
+                x=nx; if(G) prev=G->gi; q=nq; fit=q; fit_w=x;
             }
+            if(q>=pe){ tb_push(b,(int)(ls-s),(int)(pe-ls),x); break; }
+            if(brk && brk>ls){ tb_push(b,(int)(ls-s),(int)(brk-ls),brk_w); ls=brk; }
+            else if(fit>ls){ tb_push(b,(int)(ls-s),(int)(fit-ls),fit_w); ls=fit; }
+            else { int cp; const char *nq=(const char*)utf8_next((const unsigned char*)ls,&cp); tb_push(b,(int)(ls-s),(int)(nq-ls),text_width(fc,ls,(int)(nq-ls))); ls=nq; }
+            while(ls<pe && *ls==' ') ls++;
+        } while(ls<pe);
+        if(!*pe) break;
+        p=pe+1;
+    }
+    if(max_lines>0 && b->n>max_lines){
+        b->n=max_lines; b->cut=1;
+        TextLine *l=&b->line[b->n-1]; int ew=b->ell_w;
+        while(l->len>0 && (s[l->off+l->len-1]==' ' || (width>0 && l->w+ew>width))){
+            do l->len--; while(l->len>0 && ((unsigned char)s[l->off+l->len]&0xC0)==0x80); // back to a character start
+            l->w=text_width(fc,s+l->off,l->len);
         }
-        x+=(int)(ax*scale+0.5f); prev=cp; p=np;
+    }
+}
+static void tb_draw(const TextBox *b, uint8_t *fb, int fbw, const UiXform *t, TtfCache *fc, const TextItem *ti, OpStats *st){
+    int clip[4]={ ti->box_w>0? ti->x : INT_MIN, ti->box_h>0? ti->y : INT_MIN,
+                  ti->box_w>0? ti->x+ti->box_w : INT_MAX, ti->box_h>0? ti->y+ti->box_h : INT_MAX };
+    for(int i=0;i<b->n;i++){
+        const TextLine *l=&b->line[i]; int last=b->cut && i==b->n-1, w=l->w+(last? b->ell_w : 0), x=ti->x;
+        if(ti->box_w>0 && ti->align) x += ti->align==1? (ti->box_w-w)/2 : ti->box_w-w;
+        int baseline=ti->y+fc->asc_px+i*fc->line_px;
+        x=draw_glyphs(fb,fbw,t,fc,b->text+l->off,l->len,x,baseline,ti->r,ti->g,ti->b,ti->a,clip,st);
+        if(last) draw_glyphs(fb,fbw,t,fc,b->ell,(int)strlen(b->ell),x,baseline,ti->r,ti->g,ti->b,ti->a,clip,st);
     }
 }
 
 // PNG static loader --------------------------------------------------------------
 typedef struct { int w,h; uint8_t *rgba; } ImageRGBA;
+// Returns rgba==NULL on failure (callers may run on the loader thread)
 static ImageRGBA load_png_rgba_stb(const char *path){
     ImageRGBA p={0}; int comp=0; unsigned char *data=stbi_load(path,&p.w,&p.h,&comp,4);
-    if(!data){ fprintf(stderr,"stbi_load failed: %s\n", path); exit(1); }
+    if(!data){ fprintf(stderr,"stbi_load failed: %s\n", path); p.w=p.h=0; return p; }
     p.rgba=data; premultiply_rgba(p.rgba,p.w,p.h); return p;
 }
+// Reads just the IHDR size (first 24 bytes) so a placeholder can be sized before decoding
+static int png_peek_size(const char *path, int *w, int *h){
+    unsigned char b[24]; FILE *f=fopen(path,"rb"); if(!f) return -1;
+    size_t n=fread(b,1,sizeof b,f); fclose(f);
+    if(n!=sizeof b || memcmp(b+12,"IHDR",4)!=0) return -1;
+    *w=(int)be32r(b+16); *h=(int)be32r(b+20); return 0;
+}
 static void free_imgrgba(ImageRGBA *p){ if(p->rgba){ stbi_image_free(p->rgba); p->rgba=NULL; } }
 
 // APNG precompose via LodePNG ----------------------------------------------------
@@ -714,303 +1885,226 @@ static const unsigned char* chunk_type_ptr(const Chunk *ch){ return ch->data+4;
 static const unsigned char* chunk_dataptr(const Chunk *ch){ uint32_t len=be32r(ch->data); return ch->data+8; }
 static uint32_t chunk_datalen(const Chunk *ch){ return be32r(ch->data); }
 
-// Precompose APNG into full frames (fixed fcTL offsets; robust tiny-PNG build)
-static int apng_load_precompose(const char *path, ApngAnim *A, int rotate180_all){
-    memset(A,0,sizeof *A);
+// Incremental APNG decoder: composes one display frame per call, so callers can
+// precompose everything, stop after the first frame, or stream frames on demand
+// (fixed fcTL offsets; robust tiny-PNG build).
+typedef struct {
+    unsigned w,h,x,y, delay_num, delay_den; unsigned char dispose_op, blend_op;
+    ByteVec idata; int in_use;
+} FrameBuild;
 
-    // Load entire file
+typedef struct {
+    unsigned char *file; size_t filesize;   // whole file (owned)
+    Reader r;                               // chunk cursor
+    unsigned char ihdr_base[13]; int ihdr_base_set;
+    ByteVec header_chunks;                  // raw pre-IDAT ancillary chunks
+    unsigned acTL_frames, plays; int saw_acTL, saw_IDAT_or_fd;
+    unsigned canvas_w, canvas_h;
+    FrameBuild cur;
+    uint8_t *canvas, *canvas_prev, *out;    // out: rotated copy when rotate180
+    int rotate180;
+    // dispose of the last emitted frame, applied before composing the next one
+    unsigned char pend_dispose; unsigned pend_x,pend_y,pend_w,pend_h;
+    unsigned frames_out;                    // frames produced since (re)start
+    int done;
+    int dry;                                // walk frames/delays without decoding pixels
+} ApngDecoder;
+
+static const unsigned char png_sig[8]={137,80,78,71,13,10,26,10};
+
+static void apng_dec_reset_stream(ApngDecoder *D){
+    D->r.p=D->file+8; D->r.left=D->filesize-8;
+    bv_free(&D->cur.idata); memset(&D->cur,0,sizeof D->cur);
+    bv_free(&D->header_chunks);
+    D->ihdr_base_set=0; D->saw_acTL=0; D->saw_IDAT_or_fd=0; D->acTL_frames=0; D->plays=0;
+    D->pend_dispose=0; D->frames_out=0; D->done=0;
+    if(D->canvas) memset(D->canvas,0,(size_t)D->canvas_w*D->canvas_h*4);
+}
+static void apng_dec_close(ApngDecoder *D){
+    bv_free(&D->cur.idata); bv_free(&D->header_chunks);
+    free(D->file); free(D->canvas); free(D->canvas_prev); free(D->out);
+    memset(D,0,sizeof *D);
+}
+// Takes ownership of file (malloc'd).
+static int apng_dec_open_mem(ApngDecoder *D, unsigned char *file, size_t filesize, int rotate180){
+    memset(D,0,sizeof *D);
+    if(!file || filesize<33 || memcmp(file,png_sig,8)!=0){ free(file); return -1; }
+    D->file=file; D->filesize=filesize; D->rotate180=rotate180;
+    apng_dec_reset_stream(D);
+    return 0;
+}
+static int apng_dec_open(ApngDecoder *D, const char *path, int rotate180){
     unsigned char *filedata=NULL; size_t filesize=0;
     unsigned err = lodepng_load_file(&filedata,&filesize,(const char*)path);
-    if(err || !filedata || filesize<33){ fprintf(stderr,"apng: file read failed %s (%u)\n", path, err); free(filedata); return -1; }
-
-    // PNG signature
-    static const unsigned char sig[8]={137,80,78,71,13,10,26,10};
-    if(memcmp(filedata,sig,8)!=0){ free(filedata); return -1; }
-
-    Reader r={ filedata+8, filesize-8 };
-
-    // Parse IHDR and collect safe header chunks (before first IDAT/fdAT)
-    unsigned char ihdr_base[13]={0}; int ihdr_base_set=0;
-    Chunk ch; ByteVec header_chunks; bv_init(&header_chunks);
-    unsigned acTL_frames=0, acTL_plays=0;
-    int saw_acTL=0, saw_IDAT_or_fd=0;
-
-    typedef struct {
-        unsigned w,h,x,y, delay_num, delay_den; unsigned char dispose_op, blend_op;
-        ByteVec idata; int in_use;
-    } FrameBuild;
-
-    FrameBuild cur; memset(&cur,0,sizeof cur); bv_init(&cur.idata);
-    unsigned canvas_w=0, canvas_h=0;
-    unsigned num_frames=0;
+    if(err || !filedata || filesize<33){ fprintf(stderr,"apng: file read failed %s (%u)\n", path, err); free(filedata); memset(D,0,sizeof *D); return -1; }
+    return apng_dec_open_mem(D, filedata, filesize, rotate180);
+}
+static void apng_dec_rewind(ApngDecoder *D){ apng_dec_reset_stream(D); }
+
+// Decode the pending frame's IDAT/fdAT and compose it onto the canvas.
+static int apng_dec_compose(ApngDecoder *D){
+    FrameBuild *cur=&D->cur;
+    ByteVec png; bv_init(&png); bv_push(&png, png_sig, 8);
+    unsigned char IHDR_mod[13]; memcpy(IHDR_mod,D->ihdr_base,13);
+    be32w(IHDR_mod+0, cur->w); be32w(IHDR_mod+4, cur->h);
+    write_chunk(&png,"IHDR",IHDR_mod,13);
+    // Append raw pre-IDAT ancillary chunks as-is (length+type+data+crc)
+    if(D->header_chunks.size) bv_push(&png, D->header_chunks.data, D->header_chunks.size);
+    write_chunk(&png,"IDAT", cur->idata.data, cur->idata.size);
+    write_chunk(&png,"IEND", NULL, 0);
+
+    unsigned char *fr=NULL; unsigned fw=0,fh=0;
+    int derr = decode_png_rgba_lenient(png.data, png.size, &fr, &fw, &fh);
+    bv_free(&png);
+    if(derr) return -1;
+    if(fw!=cur->w || fh!=cur->h){
+        fprintf(stderr,"apng: decoded size mismatch: got %ux%u, expected %ux%u\n", fw,fh,cur->w,cur->h);
+        stbi_image_free(fr); return -1;
+    }
+    size_t csz=(size_t)D->canvas_w*D->canvas_h*4;
+    if(!D->canvas){
+        D->canvas=(uint8_t*)calloc(csz,1); D->canvas_prev=(uint8_t*)calloc(csz,1);
+        if(!D->canvas||!D->canvas_prev) die("calloc apng canvas");
+    }
+    // Dispose of the previous frame
+    if(D->pend_dispose==1){ // BACKGROUND
+        for(unsigned y=0;y<D->pend_h;y++) memset(D->canvas + 4*((size_t)(D->pend_y+y)*D->canvas_w + D->pend_x), 0, (size_t)D->pend_w*4);
+    } else if(D->pend_dispose==2){ // PREVIOUS
+        memcpy(D->canvas, D->canvas_prev, csz);
+    }
+    D->pend_dispose=0;
 
-    // Composition canvas
-    uint8_t *canvas=NULL,*canvas_prev=NULL;
+    premultiply_rgba(fr, fw, fh);
+    if(cur->dispose_op==2) memcpy(D->canvas_prev, D->canvas, csz);
 
-    // Iterate chunks
-    while(next_chunk(&r,&ch)){
+    // Clamp placement safely
+    unsigned maxw = cur->w, maxh = cur->h;
+    if(cur->x>=D->canvas_w || cur->y>=D->canvas_h){ maxw=maxh=0; }
+    else {
+        if((uint64_t)cur->x + maxw > D->canvas_w) maxw = D->canvas_w - cur->x;
+        if((uint64_t)cur->y + maxh > D->canvas_h) maxh = D->canvas_h - cur->y;
+    }
+    // Blend
+    for(unsigned y=0;y<maxh;y++){
+        uint8_t *dst = D->canvas + 4*((size_t)(cur->y+y)*D->canvas_w + cur->x);
+        const uint8_t *src = fr + 4*((size_t)y*cur->w);
+        if(cur->blend_op==0) memcpy(dst, src, (size_t)maxw*4); // SOURCE
+        else for(unsigned x=0;x<maxw;x++) over_premul(dst+4*x, src+4*x); // OVER
+    }
+    stbi_image_free(fr);
+    D->pend_dispose=cur->dispose_op; D->pend_x=cur->x; D->pend_y=cur->y; D->pend_w=maxw; D->pend_h=maxh;
+    return 0;
+}
+static unsigned apng_frame_delay_ms(const FrameBuild *cur){
+    unsigned den = cur->delay_den? cur->delay_den : 100; // 0 => 100 (centiseconds)
+    unsigned num = cur->delay_num? cur->delay_num : 1;   // clamp minimum
+    unsigned ms = (unsigned)((1000ull*num + den/2) / den);
+    return ms<10? 10 : ms;
+}
+// Finish the pending frame: compose it and hand out the canvas.
+static int apng_dec_emit(ApngDecoder *D, const uint8_t **frame, unsigned *delay_ms){
+    if(!D->dry && apng_dec_compose(D)!=0) return -1;
+    *delay_ms = apng_frame_delay_ms(&D->cur);
+    bv_free(&D->cur.idata); memset(&D->cur,0,sizeof D->cur);
+    D->frames_out++;
+    if(D->dry){ *frame=NULL; return 1; }
+    if(D->rotate180){
+        size_t csz=(size_t)D->canvas_w*D->canvas_h*4;
+        if(!D->out){ D->out=(uint8_t*)malloc(csz); if(!D->out) die("malloc apng out"); }
+        memcpy(D->out, D->canvas, csz); rotate180_rgba(D->out, (int)D->canvas_w, (int)D->canvas_h);
+        *frame=D->out;
+    } else *frame=D->canvas;
+    return 1;
+}
+// Returns 1 with the next composed frame (premultiplied, canvas-sized; valid
+// until the next call), 0 at the end of the stream, -1 on error.
+static int apng_dec_next(ApngDecoder *D, const uint8_t **frame, unsigned *delay_ms){
+    if(D->done) return 0;
+    Chunk ch;
+    while(next_chunk(&D->r,&ch)){
         const unsigned char *type = chunk_type_ptr(&ch);
         const unsigned char *data = chunk_dataptr(&ch);
         uint32_t dlen = chunk_datalen(&ch);
 
         if(memcmp(type,"IHDR",4)==0){
-            if(dlen!=13){ fprintf(stderr,"apng: bad IHDR\n"); goto fail; }
-            memcpy(ihdr_base,data,13); ihdr_base_set=1;
-            canvas_w = be32r(data+0); canvas_h = be32r(data+4);
+            if(dlen!=13){ fprintf(stderr,"apng: bad IHDR\n"); return -1; }
+            unsigned cw=be32r(data+0), chh=be32r(data+4);
+            if(D->canvas && (cw!=D->canvas_w || chh!=D->canvas_h)){ free(D->canvas); free(D->canvas_prev); free(D->out); D->canvas=D->canvas_prev=D->out=NULL; }
+            memcpy(D->ihdr_base,data,13); D->ihdr_base_set=1;
+            D->canvas_w = cw; D->canvas_h = chh;
             continue;
         }
-        if(!ihdr_base_set){ fprintf(stderr,"apng: IHDR missing\n"); goto fail; }
+        if(!D->ihdr_base_set){ fprintf(stderr,"apng: IHDR missing\n"); return -1; }
 
         if(memcmp(type,"acTL",4)==0){
-            if(dlen!=8){ fprintf(stderr,"apng: bad acTL\n"); goto fail; }
-            acTL_frames = be32r(data+0); acTL_plays = be32r(data+4);
-            saw_acTL=1;
+            if(dlen!=8){ fprintf(stderr,"apng: bad acTL\n"); return -1; }
+            D->acTL_frames = be32r(data+0); D->plays = be32r(data+4);
+            D->saw_acTL=1;
             continue;
         }
         if(memcmp(type,"fcTL",4)==0){
-            if(dlen!=26){ fprintf(stderr,"apng: bad fcTL\n"); goto fail; }
-
-            // finalize previous frame (if any)
-            if(cur.in_use){
-                if(cur.idata.size==0){ // empty frame: ignore safely
-                    bv_free(&cur.idata); memset(&cur,0,sizeof cur);
-                } else {
-                    // Build minimal PNG for the frame IDAT
-                    ByteVec png; bv_init(&png); bv_push(&png, sig, 8);
-
-                    unsigned char IHDR_mod[13]; memcpy(IHDR_mod,ihdr_base,13);
-                    be32w(IHDR_mod+0, cur.w); be32w(IHDR_mod+4, cur.h);
-                    write_chunk(&png,"IHDR",IHDR_mod,13);
-
-                    if(header_chunks.size){
-                        // Append raw pre-IDAT ancillary chunks as-is (length+type+data+crc)
-                        bv_push(&png, header_chunks.data, header_chunks.size);
-                    }
-
-                    write_chunk(&png,"IDAT", cur.idata.data, cur.idata.size);
-                    write_chunk(&png,"IEND", NULL, 0);
-
-                    // Decode using lodepng state (tolerant)
-                    /*unsigned char *fr=NULL; unsigned fw=0,fh=0;
-                    LodePNGState st; lodepng_state_init(&st);
-                    st.decoder.ignore_crc = 1;
-                    st.decoder.zlibsettings.ignore_nlen = 1;
-                    st.decoder.zlibsettings.ignore_adler32 = 1;
-
-                    err = lodepng_decode(&fr,&fw,&fh,&st,png.data,png.size,LCT_RGBA,8);
-                    if(err){
-                        fprintf(stderr,"apng: decode frame failed %u: %s\n", err, lodepng_error_text(err));
-                        lodepng_state_cleanup(&st); bv_free(&png); goto fail;
-                    }
-                    lodepng_state_cleanup(&st);
-                    bv_free(&png);*/
-
-                    unsigned char *fr=NULL; unsigned fw=0,fh=0;
-                    int derr = decode_png_rgba_lenient(png.data, png.size, &fr, &fw, &fh);
-                    if(derr){ bv_free(&png); goto fail; }
-                    bv_free(&png);
-
-
-                    if(fw!=cur.w || fh!=cur.h){
-                        fprintf(stderr,"apng: decoded size mismatch: got %ux%u, expected %ux%u\n", fw,fh,cur.w,cur.h);
-                        stbi_image_free(fr); goto fail;
-                    }
-
-                    if(!canvas){
-                        canvas=(uint8_t*)calloc((size_t)canvas_w*canvas_h,4);
-                        canvas_prev=(uint8_t*)calloc((size_t)canvas_w*canvas_h,4);
-                        if(!canvas||!canvas_prev) die("calloc apng canvas");
-                    }
-
-                    premultiply_rgba(fr, fw, fh);
-                    if(rotate180_all){ rotate180_rgba(fr, fw, fh); }
-
-                    if(cur.dispose_op==2){ memcpy(canvas_prev, canvas, (size_t)canvas_w*canvas_h*4); }
-
-                    // Clamp placement safely
-                    unsigned maxw = cur.w, maxh = cur.h;
-                    if((uint64_t)cur.x + maxw > canvas_w) maxw = canvas_w - cur.x;
-                    if((uint64_t)cur.y + maxh > canvas_h) maxh = canvas_h - cur.y;
-
-                    // Blend
-                    for(unsigned y=0;y<maxh;y++){
-                        int dy=cur.y+(int)y;
-                        for(unsigned x=0;x<maxw;x++){
-                            int dx=cur.x+(int)x;
-                            uint8_t *dst = canvas + 4*((size_t)dy*canvas_w + dx);
-                            const uint8_t *src = fr + 4*((size_t)y*cur.w + x);
-                            if(cur.blend_op==0){ // SOURCE
-                                dst[0]=src[0]; dst[1]=src[1]; dst[2]=src[2]; dst[3]=src[3];
-                            }else{ // OVER
-                                over_premul(dst, src);
-                            }
-                        }
-                    }
-
-                    // Store display frame
-                    A->frame_rgba = (uint8_t**)realloc(A->frame_rgba, (A->num_frames+1)*sizeof(uint8_t*));
-                    A->delay_ms   = (unsigned*)realloc(A->delay_ms,   (A->num_frames+1)*sizeof(unsigned));
-                    if(!A->frame_rgba||!A->delay_ms) die("realloc apng frames");
-                    uint8_t *frame_copy=(uint8_t*)malloc((size_t)canvas_w*canvas_h*4);
-                    if(!frame_copy) die("malloc apng frame");
-                    memcpy(frame_copy, canvas, (size_t)canvas_w*canvas_h*4);
-                    A->frame_rgba[A->num_frames]=frame_copy;
-
-                    unsigned den = cur.delay_den? cur.delay_den : 100; // 0 => 100 (centiseconds)
-                    unsigned num = cur.delay_num? cur.delay_num : 1;   // clamp minimum
-                    unsigned ms = (unsigned)((1000ull*num + den/2) / den);
-                    if(ms<10) ms=10;
-                    A->delay_ms[A->num_frames]=ms;
-                    A->total_ms += ms;
-                    A->num_frames++;
-
-                    // Dispose
-                    if(cur.dispose_op==1){ // BACKGROUND
-                        for(unsigned y=0;y<maxh;y++){
-                            int dy=cur.y+(int)y;
-                            for(unsigned x=0;x<maxw;x++){
-                                int dx=cur.x+(int)x;
-                                uint8_t *dst = canvas + 4*((size_t)dy*canvas_w + dx);
-                                dst[0]=dst[1]=dst[2]=dst[3]=0;
-                            }
-                        }
-                    } else if(cur.dispose_op==2){ // PREVIOUS
-                        memcpy(canvas, canvas_prev, (size_t)canvas_w*canvas_h*4);
-                    }
-
-                    stbi_image_free(fr);
-                    bv_free(&cur.idata); memset(&cur,0,sizeof cur);
-                }
+            if(dlen!=26){ fprintf(stderr,"apng: bad fcTL\n"); return -1; }
+            FrameBuild next; memset(&next,0,sizeof next);
+            // skip seq number: 4 bytes
+            next.w = be32r(data + 4);  next.h = be32r(data + 8);
+            next.x = be32r(data + 12); next.y = be32r(data + 16);
+            next.delay_num = (data[20]<<8) | data[21];
+            next.delay_den = (data[22]<<8) | data[23];
+            next.dispose_op = data[24]; next.blend_op = data[25];
+            if(next.w==0 || next.h==0){ fprintf(stderr,"apng: bad fcTL (zero size)\n"); return -1; }
+            next.in_use=1;
+
+            int have = D->cur.in_use && D->cur.idata.size>0;
+            if(D->cur.in_use && !have){ bv_free(&D->cur.idata); memset(&D->cur,0,sizeof D->cur); } // empty frame: ignore safely
+            if(have){
+                int rc=apng_dec_emit(D,frame,delay_ms);
+                D->cur=next; bv_init(&D->cur.idata);
+                return rc;
             }
-
-            // Start new frame (skip seq number: 4 bytes)
-            cur.w = be32r(data + 4);
-            cur.h = be32r(data + 8);
-            cur.x = be32r(data + 12);
-            cur.y = be32r(data + 16);
-            cur.delay_num = (data[20]<<8) | data[21];
-            cur.delay_den = (data[22]<<8) | data[23];
-            cur.dispose_op = data[24];
-            cur.blend_op   = data[25];
-
-            if(cur.w==0 || cur.h==0){ fprintf(stderr,"apng: bad fcTL (zero size)\n"); goto fail; }
-            bv_init(&cur.idata); cur.in_use=1;
+            D->cur=next; bv_init(&D->cur.idata);
             continue;
         }
         if(memcmp(type,"fdAT",4)==0){
-            if(!cur.in_use) continue; // stray
-            if(dlen<4) { fprintf(stderr,"apng: bad fdAT\n"); goto fail; }
-            bv_push(&cur.idata, data+4, dlen-4); // skip seq
-            saw_IDAT_or_fd=1;
+            if(!D->cur.in_use) continue; // stray
+            if(dlen<4) { fprintf(stderr,"apng: bad fdAT\n"); return -1; }
+            bv_push(&D->cur.idata, data+4, dlen-4); // skip seq
+            D->saw_IDAT_or_fd=1;
             continue;
         }
         if(memcmp(type,"IDAT",4)==0){
-            if(!cur.in_use){
+            if(!D->cur.in_use){
                 // Frame 0 without prior fcTL: synthesize default
-                cur.w = canvas_w; cur.h = canvas_h; cur.x=0; cur.y=0;
-                cur.delay_num=10; cur.delay_den=100; cur.dispose_op=0; cur.blend_op=0;
-                bv_init(&cur.idata); cur.in_use=1;
+                D->cur.w = D->canvas_w; D->cur.h = D->canvas_h; D->cur.x=0; D->cur.y=0;
+                D->cur.delay_num=10; D->cur.delay_den=100; D->cur.dispose_op=0; D->cur.blend_op=0;
+                bv_init(&D->cur.idata); D->cur.in_use=1;
             }
-            bv_push(&cur.idata, data, dlen);
-            saw_IDAT_or_fd=1;
+            bv_push(&D->cur.idata, data, dlen);
+            D->saw_IDAT_or_fd=1;
             continue;
         }
         if(memcmp(type,"IEND",4)==0){
-            // finalize any pending frame
-            if(cur.in_use && cur.idata.size>0){
-                ByteVec png; bv_init(&png); bv_push(&png,sig,8);
-                unsigned char IHDR_mod[13]; memcpy(IHDR_mod,ihdr_base,13);
-                be32w(IHDR_mod+0, cur.w); be32w(IHDR_mod+4, cur.h);
-                write_chunk(&png,"IHDR",IHDR_mod,13);
-                if(header_chunks.size){ bv_push(&png, header_chunks.data, header_chunks.size); }
-                write_chunk(&png,"IDAT", cur.idata.data, cur.idata.size);
-                write_chunk(&png,"IEND", NULL, 0);
-
-                unsigned char *fr = NULL; unsigned fw = 0, fh = 0;
-                int derr = decode_png_rgba_lenient(png.data, png.size, &fr, &fw, &fh);
-                if (derr) { bv_free(&png); goto fail; }
-                bv_free(&png);
-
-                if(fw!=cur.w || fh!=cur.h){
-                    fprintf(stderr,"apng: decoded size mismatch: got %ux%u, expected %ux%u\n", fw,fh,cur.w,cur.h);
-                    stbi_image_free(fr); goto fail;
-                }
-
-                if(!canvas){
-                    canvas=(uint8_t*)calloc((size_t)canvas_w*canvas_h,4);
-                    canvas_prev=(uint8_t*)calloc((size_t)canvas_w*canvas_h,4);
-                    if(!canvas||!canvas_prev) die("calloc apng canvas");
-                }
-
-                premultiply_rgba(fr, fw, fh);
-                if(rotate180_all){ rotate180_rgba(fr, fw, fh); }
-                if(cur.dispose_op==2){ memcpy(canvas_prev,canvas,(size_t)canvas_w*canvas_h*4); }
-
-                unsigned maxw = cur.w, maxh = cur.h;
-                if((uint64_t)cur.x + maxw > canvas_w) maxw = canvas_w - cur.x;
-                if((uint64_t)cur.y + maxh > canvas_h) maxh = canvas_h - cur.y;
-
-                for(unsigned y=0;y<maxh;y++){
-                    int dy=cur.y+(int)y;
-                    for(unsigned x=0;x<maxw;x++){
-                        int dx=cur.x+(int)x;
-                        uint8_t *dst = canvas + 4*((size_t)dy*canvas_w + dx);
-                        const uint8_t *src = fr + 4*((size_t)y*cur.w + x);
-                        if(cur.blend_op==0){ dst[0]=src[0]; dst[1]=src[1]; dst[2]=src[2]; dst[3]=src[3]; }
-                        else over_premul(dst,src);
-                    }
-                }
-                A->frame_rgba = (uint8_t**)realloc(A->frame_rgba, (A->num_frames+1)*sizeof(uint8_t*));
-                A->delay_ms   = (unsigned*)realloc(A->delay_ms,   (A->num_frames+1)*sizeof(unsigned));
-                if(!A->frame_rgba||!A->delay_ms) die("realloc apng frames");
-                uint8_t *frame_copy=(uint8_t*)malloc((size_t)canvas_w*canvas_h*4); if(!frame_copy) die("malloc apng frame");
-                memcpy(frame_copy, canvas, (size_t)canvas_w*canvas_h*4);
-                A->frame_rgba[A->num_frames]=frame_copy;
-
-                unsigned den = cur.delay_den? cur.delay_den : 100;
-                unsigned num = cur.delay_num? cur.delay_num : 1;
-                unsigned ms = (unsigned)((1000ull*num + den/2) / den); if(ms<10) ms=10;
-                A->delay_ms[A->num_frames]=ms;
-                A->total_ms += ms; A->num_frames++;
-
-                if(cur.dispose_op==1){
-                    for(unsigned y=0;y<maxh;y++){ int dy=cur.y+(int)y;
-                        for(unsigned x=0;x<maxw;x++){ int dx=cur.x+(int)x;
-                            uint8_t *dst=canvas+4*((size_t)dy*canvas_w+dx); dst[0]=dst[1]=dst[2]=dst[3]=0; } }
-                } else if(cur.dispose_op==2){ memcpy(canvas,canvas_prev,(size_t)canvas_w*canvas_h*4); }
-                stbi_image_free(fr);
-                bv_free(&cur.idata); memset(&cur,0,sizeof cur);
-            }
-            break;
-        }
-
-        // Header chunk collection (before first IDAT/fdAT only; skip acTL/fcTL)
-        if(!saw_IDAT_or_fd){
-            if(memcmp(type,"acTL",4)!=0 && memcmp(type,"fcTL",4)!=0 && memcmp(type,"IHDR",4)!=0){
-                // copy entire chunk raw (length+type+data+crc)
-                bv_push(&header_chunks, ch.data, ch.len);
-            }
+            D->done=1;
+            if(D->cur.in_use && D->cur.idata.size>0) return apng_dec_emit(D,frame,delay_ms);
+            return 0;
         }
+        // Header chunk collection (before first IDAT/fdAT only)
+        if(!D->saw_IDAT_or_fd) bv_push(&D->header_chunks, ch.data, ch.len); // copy entire chunk raw (length+type+data+crc)
     }
-
-    bv_free(&header_chunks);
-    free(filedata);
-
-    if(!saw_acTL || A->num_frames==0){
-        // Not animated: let caller decode as static
-        apnganim_free(A);
-        return 1; // signal: static PNG
-    }
-
-    A->is_apng=1; A->plays=acTL_plays; A->canvas_w=canvas_w; A->canvas_h=canvas_h;
-    free(canvas); free(canvas_prev);
+    D->done=1;
+    if(D->cur.in_use && D->cur.idata.size>0) return apng_dec_emit(D,frame,delay_ms); // truncated file: keep what we have
     return 0;
+}
 
-fail:
-    bv_free(&header_chunks);
-    free(filedata);
-    apnganim_free(A);
-    return -1;
+// Append a copy of a composed frame to an ApngAnim
+static void apnganim_push(ApngAnim *A, const uint8_t *frame, unsigned delay_ms){
+    size_t fsz=(size_t)A->canvas_w*A->canvas_h*4;
+    A->frame_rgba = (uint8_t**)realloc(A->frame_rgba, (A->num_frames+1)*sizeof(uint8_t*));
+    A->delay_ms   = (unsigned*)realloc(A->delay_ms,   (A->num_frames+1)*sizeof(unsigned));
+    if(!A->frame_rgba||!A->delay_ms) die("realloc apng frames");
+    uint8_t *frame_copy=(uint8_t*)malloc(fsz); if(!frame_copy) die("malloc apng frame");
+    memcpy(frame_copy, frame, fsz);
+    A->frame_rgba[A->num_frames]=frame_copy; A->delay_ms[A->num_frames]=delay_ms;
+    A->total_ms += delay_ms; A->num_frames++;
 }
 
 // Choose frame by time/loops/speed ----------------------------------------------
@@ -1044,40 +2138,327 @@ static unsigned apng_pick_frame(const ApngAnim *A, uint64_t base_ms, double spee
 }
 
 // FB/Viewport & RGB565 -----------------------------------------------------------
-static int FBW= (W*3)/2, FBH= (H*3)/2;
+static int FBW, FBH; // set by compute_fb once the device profile is known
 static void compute_fb(const Layout *L){ int p=(L->fb_scale_percent<100)?100:L->fb_scale_percent; FBW=(W*p+99)/100; FBH=(H*p+99)/100; }
 static void compute_viewport(const Layout *L, int *vx, int *vy){
     int x=(L->viewport_x<0)?(FBW - W)/2 : L->viewport_x;
     int y=(L->viewport_y<0)?(FBH - H)/2 : L->viewport_y;
     if(x<0)x=0; if(y<0)y=0; if(x>FBW-W)x=FBW-W; if(y>FBH-H)y=FBH-H; *vx=x; *vy=y;
 }
-static uint8_t* viewport_to_rgb565(const uint8_t *fb,int fbw,int fbh,int vx,int vy){
-    (void)fbh; size_t px=(size_t)W*H; uint8_t *out=(uint8_t*)malloc(px*2); if(!out) die("malloc565");
-    size_t j=0;
+static inline void unpremul_px(const uint8_t *p, uint8_t *r, uint8_t *g, uint8_t *b){
+    uint8_t pa=p[3];
+    if(pa==0){ *r=*g=*b=0; }
+    else if(pa==255){ *r=p[0]; *g=p[1]; *b=p[2]; }
+    else { *r=(uint8_t)((p[0]*255 + (pa>>1))/pa); *g=(uint8_t)((p[1]*255 + (pa>>1))/pa); *b=(uint8_t)((p[2]*255 + (pa>>1))/pa); }
+}
+// RGB565 pack, instantiated with constant sizes for the known panels so the
+// row loop gets unrolled/vectorized; pack565_any covers custom geometries.
+static inline __attribute__((always_inline)) void pack565_rows(const uint8_t *fb,int fbw,int vx,int vy,uint8_t *out,int w,int h){
+    for(int y=0;y<h;y++){
+        const uint8_t *row = fb + 4*((size_t)(vy+y)*fbw + vx);
+        uint8_t *o = out + (size_t)y*w*2;
+        for(int x=0;x<w;x++){
+            uint8_t r,g,b; unpremul_px(row+4*x,&r,&g,&b);
+            uint16_t v=((r&0xF8)<<8)|((g&0xFC)<<3)|(b>>3);
+            o[2*x]=(uint8_t)(v & 0xFF); o[2*x+1]=(uint8_t)(v>>8);
+        }
+    }
+}
+typedef void (*Pack565Fn)(const uint8_t *fb,int fbw,int vx,int vy,uint8_t *out);
+#define PACK565_SIZES(X) X(240,320) X(320,240) X(320,320) X(480,480)
+#define PACK565_DEF(w,h) static void pack565_##w##x##h(const uint8_t *fb,int fbw,int vx,int vy,uint8_t *out){ pack565_rows(fb,fbw,vx,vy,out,w,h); }
+PACK565_SIZES(PACK565_DEF)
+static void pack565_any(const uint8_t *fb,int fbw,int vx,int vy,uint8_t *out){ pack565_rows(fb,fbw,vx,vy,out,W,H); }
+static Pack565Fn pack565_for(int w,int h){
+#define PACK565_PICK(pw,ph) if(w==pw && h==ph) return pack565_##pw##x##ph;
+    PACK565_SIZES(PACK565_PICK)
+#undef PACK565_PICK
+    return pack565_any;
+}
+static Pack565Fn g_pack565 = pack565_any; // set once the profile is known
+static void viewport_to_rgb565(const uint8_t *fb,int fbw,int fbh,int vx,int vy,uint8_t *out){
+    (void)fbh; g_pack565(fb,fbw,vx,vy,out);
+}
+// Same pixels as RGB888 (W*H*3) for the JPEG encoder
+static void viewport_to_rgb888(const uint8_t *fb,int fbw,int fbh,int vx,int vy,uint8_t *out){
+    (void)fbh;
     for(int y=0;y<H;y++){
         const uint8_t *row = fb + 4*((vy+y)*fbw + vx);
-        for(int x=0;x<W;x++){
-            uint8_t pr=row[0],pg=row[1],pb=row[2],pa=row[3]; uint8_t r,g,b;
-            if(pa==0){ r=g=b=0; }
-            else if(pa==255){ r=pr; g=pg; b=pb; }
-            else { r=(uint8_t)((pr*255 + (pa>>1))/pa); g=(uint8_t)((pg*255 + (pa>>1))/pa); b=(uint8_t)((pb*255 + (pa>>1))/pa); }
-            uint16_t v=((r&0xF8)<<8)|((g&0xFC)<<3)|(b>>3);
-            out[j++]=(uint8_t)(v & 0xFF); out[j++]=(uint8_t)(v>>8); row+=4;
+        for(int x=0;x<W;x++,row+=4,out+=3) unpremul_px(row,out,out+1,out+2);
+    }
+}
+
+// Page transitions -----------------------------------------------------------------
+// A page switch (or reload) keeps the last frame's viewport as `from` and the
+// first complete frame of the new page as `to`; each transition frame is one
+// pass over the viewport from those two, with nothing recomposited. The new
+// page stands still until the transition ends.
+typedef struct {
+    uint8_t *from, *to;         // W*H premultiplied RGBA (allocated on first use)
+    int kind, ms;               // index into g_trans_names (0 = none running), duration
+    int pending;                // `from` taken; waiting for a complete frame of the new page
+    uint64_t t0;                // start, ms
+    int dx, dy;                 // slide/wipe direction in panel coordinates
+} Transition;
+static void tr_capture(uint8_t **buf, const uint8_t *fb, int fbw, int vx, int vy){
+    size_t rb=(size_t)W*4;
+    if(!*buf && !(*buf=(uint8_t*)malloc(rb*H))) die("malloc transition");
+    for(int y=0;y<H;y++) memcpy(*buf+rb*y, fb+4*((size_t)(vy+y)*fbw+vx), rb);
+}
+// Starts a transition from what fb's viewport shows now. Directions are in
+// layout coordinates and turn with text_orientation, like overlays.
+static void tr_begin(Transition *T, const Layout *L, int kind, int ms, const uint8_t *fb, int fbw, int fbh, int vx, int vy){
+    T->kind=0; T->pending=0;
+    if(kind<=0 || ms<=0) return;
+    tr_capture(&T->from,fb,fbw,vx,vy);
+    static const int dir[4][2]={ {-1,0}, {1,0}, {0,-1}, {0,1} };
+    UiXform t; ui_xform(&t,L->text_orient,L->text_flip,L->text_landscape_ccw,fbw,fbh,L);
+    const int *d = kind>=2? dir[(kind-2)%4] : dir[0];
+    T->dx=t.k->ax*d[0]+t.k->ay*d[1]; T->dy=t.k->cx*d[0]+t.k->cy*d[1];
+    T->kind=kind; T->ms=ms; T->pending=1;
+}
+// Writes the transition frame for `now` into fb's viewport (`from` while the
+// new page is pending). Returns 0 once the last frame (`to`) is written.
+static int tr_render(Transition *T, uint8_t *fb, int fbw, int vx, int vy, uint64_t now){
+    uint64_t el = T->pending? 0 : now-T->t0;
+    int done = !T->pending && el>=(uint64_t)T->ms, a = done? 256 : (int)(el*256/T->ms); // progress, /256
+    size_t rb=(size_t)W*4;
+    const uint8_t *F=T->from, *S = T->pending? T->from : T->to;
+    int slide = T->kind>=2 && T->kind<=5, offx=W*a/256, offy=H*a/256;
+    for(int y=0;y<H;y++){
+        uint8_t *d=fb+4*((size_t)(vy+y)*fbw+vx);
+        const uint8_t *f=F+rb*y, *s=S+rb*y;
+        if(T->kind==1){ for(size_t i=0;i<rb;i++) d[i]=(uint8_t)((f[i]*(256-a)+s[i]*a)>>8); continue; }
+        if(T->dy){ // whole rows
+            int sy = slide? (T->dy<0? y+offy : y-offy) : y, in = slide? (sy<0 || sy>=H) : (T->dy<0? y>=H-offy : y<offy);
+            if(slide) sy = sy<0? sy+H : sy>=H? sy-H : sy;
+            memcpy(d,(in? S : F)+rb*sy,rb);
+        } else if(slide){
+            if(T->dx<0){ memcpy(d,f+4*(size_t)offx,4*(size_t)(W-offx)); memcpy(d+4*(size_t)(W-offx),s,4*(size_t)offx); }
+            else { memcpy(d,s+4*(size_t)(W-offx),4*(size_t)offx); memcpy(d+4*(size_t)offx,f,4*(size_t)(W-offx)); }
+        } else {
+            int b = T->dx<0? W-offx : offx; // wipe: `to` right of b (left), left of b (right)
+            const uint8_t *l = T->dx<0? f : s, *r = T->dx<0? s : f;
+            memcpy(d,l,4*(size_t)b); memcpy(d+4*(size_t)b,r+4*(size_t)b,4*(size_t)(W-b));
+        }
+    }
+    if(done) T->kind=0;
+    return !done;
+}
+
+// JPEG encoder (baseline, 4:2:0, fixed tables) ------------------------------------
+// Standard JPEG Annex K quantization and Huffman tables scaled by quality, AAN
+// float DCT. Meant for the wire, not for archiving: no restart markers, no
+// optimized tables; one W×H frame takes a couple of ms.
+static const uint8_t jpg_zz[64]={ 0,1,5,6,14,15,27,28,2,4,7,13,16,26,29,42,3,8,12,17,25,30,41,43,9,11,18,24,31,40,44,53,
+    10,19,23,32,39,45,52,54,20,22,33,38,46,51,55,60,21,34,37,47,50,56,59,61,35,36,48,49,57,58,62,63 };
+static const uint8_t jpg_qt_y[64]={ 16,11,10,16,24,40,51,61,12,12,14,19,26,58,60,55,14,13,16,24,40,57,69,56,14,17,22,29,51,87,80,62,
+    18,22,37,56,68,109,103,77,24,35,55,64,81,104,113,92,49,64,78,87,103,121,120,101,72,92,95,98,112,100,103,99 };
+static const uint8_t jpg_qt_c[64]={ 17,18,24,47,99,99,99,99,18,21,26,66,99,99,99,99,24,26,56,99,99,99,99,99,47,66,99,99,99,99,99,99,
+    99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99,99 };
+static const uint8_t jpg_dc_bits_y[16]={0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
+static const uint8_t jpg_dc_bits_c[16]={0,3,1,1,1,1,1,1,1,1,1,0,0,0,0,0};
+static const uint8_t jpg_dc_vals[12]={0,1,2,3,4,5,6,7,8,9,10,11};
+static const uint8_t jpg_ac_bits_y[16]={0,2,1,3,3,2,4,3,5,5,4,4,0,0,1,0x7d};
+static const uint8_t jpg_ac_vals_y[162]={
+    0x01,0x02,0x03,0x00,0x04,0x11,0x05,0x12,0x21,0x31,0x41,0x06,0x13,0x51,0x61,0x07,0x22,0x71,0x14,0x32,0x81,0x91,0xa1,0x08,
+    0x23,0x42,0xb1,0xc1,0x15,0x52,0xd1,0xf0,0x24,0x33,0x62,0x72,0x82,0x09,0x0a,0x16,0x17,0x18,0x19,0x1a,0x25,0x26,0x27,0x28,
+    0x29,0x2a,0x34,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,0x59,
+    0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x83,0x84,0x85,0x86,0x87,0x88,0x89,
+    0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,0xb5,0xb6,
+    0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,0xe1,0xe2,
+    0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+static const uint8_t jpg_ac_bits_c[16]={0,2,1,2,4,4,3,4,7,5,4,4,0,1,2,0x77};
+static const uint8_t jpg_ac_vals_c[162]={
+    0x00,0x01,0x02,0x03,0x11,0x04,0x05,0x21,0x31,0x06,0x12,0x41,0x51,0x07,0x61,0x71,0x13,0x22,0x32,0x81,0x08,0x14,0x42,0x91,
+    0xa1,0xb1,0xc1,0x09,0x23,0x33,0x52,0xf0,0x15,0x62,0x72,0xd1,0x0a,0x16,0x24,0x34,0xe1,0x25,0xf1,0x17,0x18,0x19,0x1a,0x26,
+    0x27,0x28,0x29,0x2a,0x35,0x36,0x37,0x38,0x39,0x3a,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x53,0x54,0x55,0x56,0x57,0x58,
+    0x59,0x5a,0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,0x73,0x74,0x75,0x76,0x77,0x78,0x79,0x7a,0x82,0x83,0x84,0x85,0x86,0x87,
+    0x88,0x89,0x8a,0x92,0x93,0x94,0x95,0x96,0x97,0x98,0x99,0x9a,0xa2,0xa3,0xa4,0xa5,0xa6,0xa7,0xa8,0xa9,0xaa,0xb2,0xb3,0xb4,
+    0xb5,0xb6,0xb7,0xb8,0xb9,0xba,0xc2,0xc3,0xc4,0xc5,0xc6,0xc7,0xc8,0xc9,0xca,0xd2,0xd3,0xd4,0xd5,0xd6,0xd7,0xd8,0xd9,0xda,
+    0xe2,0xe3,0xe4,0xe5,0xe6,0xe7,0xe8,0xe9,0xea,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa };
+
+typedef struct { uint16_t code[256]; uint8_t len[256]; } JpgHuff;
+typedef struct {
+    int quality;                    // tables below are built for this
+    uint8_t qt_y[64], qt_c[64];     // zigzag order, as written to DQT
+    float fd_y[64], fd_c[64];       // natural order, DCT scale folded in
+    JpgHuff dc_y, dc_c, ac_y, ac_c;
+} JpgTables;
+typedef struct { ByteVec *out; uint32_t buf; int cnt; } JpgBits;
+
+static void jpg_huff_build(JpgHuff *h, const uint8_t bits[16], const uint8_t *vals){
+    memset(h,0,sizeof *h);
+    unsigned code=0, k=0;
+    for(int l=1;l<=16;l++){ for(int i=0;i<bits[l-1];i++,k++){ h->code[vals[k]]=(uint16_t)code++; h->len[vals[k]]=(uint8_t)l; } code<<=1; }
+}
+static void jpg_tables_init(JpgTables *T, int quality){
+    static const float aasf[8]={ 1.0f*2.828427125f, 1.387039845f*2.828427125f, 1.306562965f*2.828427125f, 1.175875602f*2.828427125f,
+                                 1.0f*2.828427125f, 0.785694958f*2.828427125f, 0.541196100f*2.828427125f, 0.275899379f*2.828427125f };
+    if(quality<1) quality=1; if(quality>100) quality=100;
+    T->quality=quality;
+    int scale = quality<50? 5000/quality : 200-quality*2;
+    for(int i=0;i<64;i++){
+        int y=(jpg_qt_y[i]*scale+50)/100, c=(jpg_qt_c[i]*scale+50)/100;
+        T->qt_y[jpg_zz[i]]=(uint8_t)(y<1?1:y>255?255:y); T->qt_c[jpg_zz[i]]=(uint8_t)(c<1?1:c>255?255:c);
+    }
+    for(int r=0,k=0;r<8;r++) for(int c=0;c<8;c++,k++){
+        T->fd_y[k]=1.0f/(T->qt_y[jpg_zz[k]]*aasf[r]*aasf[c]);
+        T->fd_c[k]=1.0f/(T->qt_c[jpg_zz[k]]*aasf[r]*aasf[c]);
+    }
+    jpg_huff_build(&T->dc_y,jpg_dc_bits_y,jpg_dc_vals); jpg_huff_build(&T->dc_c,jpg_dc_bits_c,jpg_dc_vals);
+    jpg_huff_build(&T->ac_y,jpg_ac_bits_y,jpg_ac_vals_y); jpg_huff_build(&T->ac_c,jpg_ac_bits_c,jpg_ac_vals_c);
+}
+static void jpg_put(JpgBits *b, unsigned code, int len){
+    b->cnt+=len; b->buf|=(uint32_t)code<<(24-b->cnt);
+    while(b->cnt>=8){
+        uint8_t c=(uint8_t)(b->buf>>16); bv_push(b->out,&c,1);
+        if(c==0xFF){ uint8_t z=0; bv_push(b->out,&z,1); } // byte stuffing
+        b->buf<<=8; b->cnt-=8;
+    }
+}
+// value -> (magnitude category, low bits) as in F.1.2.1
+static inline void jpg_cat(int v, unsigned *bits, int *len){
+    int a = v<0? -v : v; int n=0; while(a){ n++; a>>=1; }
+    *len=n; *bits=(unsigned)(v<0? v-1 : v) & ((1u<<n)-1);
+}
+// 1-D AAN forward DCT over 8 values spaced s apart
+static void jpg_dct8(float *d, int s){
+    float t0=d[0]+d[7*s], t7=d[0]-d[7*s], t1=d[s]+d[6*s], t6=d[s]-d[6*s];
+    float t2=d[2*s]+d[5*s], t5=d[2*s]-d[5*s], t3=d[3*s]+d[4*s], t4=d[3*s]-d[4*s];
+    float t10=t0+t3, t13=t0-t3, t11=t1+t2, t12=t1-t2;
+    d[0]=t10+t11; d[4*s]=t10-t11;
+    float z1=(t12+t13)*0.707106781f; d[2*s]=t13+z1; d[6*s]=t13-z1;
+    t10=t4+t5; t11=t5+t6; t12=t6+t7;
+    float z5=(t10-t12)*0.382683433f, z2=t10*0.541196100f+z5, z4=t12*1.306562965f+z5, z3=t11*0.707106781f;
+    float z11=t7+z3, z13=t7-z3;
+    d[5*s]=z13+z2; d[3*s]=z13-z2; d[s]=z11+z4; d[7*s]=z11-z4;
+}
+// One 8x8 block (level-shifted samples, natural order); returns its DC for the next delta
+static int jpg_block(JpgBits *b, float blk[64], const float fd[64], int prev_dc, const JpgHuff *dc, const JpgHuff *ac){
+    for(int r=0;r<64;r+=8) jpg_dct8(blk+r,1);
+    for(int c=0;c<8;c++) jpg_dct8(blk+c,8);
+    int q[64];
+    for(int i=0;i<64;i++){ float v=blk[i]*fd[i]; q[jpg_zz[i]]=(int)(v<0? v-0.5f : v+0.5f); }
+    unsigned bits; int len;
+    jpg_cat(q[0]-prev_dc,&bits,&len); jpg_put(b,dc->code[len],dc->len[len]); if(len) jpg_put(b,bits,len);
+    int last=63; while(last>0 && q[last]==0) last--;
+    for(int i=1;i<=last;i++){
+        int run=0; while(q[i]==0){ run++; i++; }
+        while(run>=16){ jpg_put(b,ac->code[0xF0],ac->len[0xF0]); run-=16; }
+        jpg_cat(q[i],&bits,&len);
+        jpg_put(b,ac->code[(run<<4)|len],ac->len[(run<<4)|len]); jpg_put(b,bits,len);
+    }
+    if(last<63) jpg_put(b,ac->code[0],ac->len[0]); // EOB
+    return q[0];
+}
+static void jpg_marker_dht(ByteVec *o, uint8_t cls_id, const uint8_t bits[16], const uint8_t *vals){
+    int n=0; for(int i=0;i<16;i++) n+=bits[i];
+    bv_push(o,&cls_id,1); bv_push(o,bits,16); bv_push(o,vals,(size_t)n);
+}
+// rgb: w*h*3 bytes. Output replaces out's contents.
+static void jpeg_encode_rgb(ByteVec *out, const uint8_t *rgb, int w, int h, const JpgTables *T){
+    out->size=0;
+    static const uint8_t soi_app0[]={ 0xFF,0xD8, 0xFF,0xE0,0,16,'J','F','I','F',0,1,1,0,0,1,0,1,0,0 };
+    bv_push(out,soi_app0,sizeof soi_app0);
+    uint8_t dqt[5]={ 0xFF,0xDB,0,132,0 }; bv_push(out,dqt,5); bv_push(out,T->qt_y,64);
+    uint8_t one=1; bv_push(out,&one,1); bv_push(out,T->qt_c,64);
+    uint8_t sof[19]={ 0xFF,0xC0,0,17,8,(uint8_t)(h>>8),(uint8_t)h,(uint8_t)(w>>8),(uint8_t)w,3, 1,0x22,0, 2,0x11,1, 3,0x11,1 };
+    bv_push(out,sof,sizeof sof);
+    uint8_t dht[4]={ 0xFF,0xC4,0x01,0xA2 }; bv_push(out,dht,4);
+    jpg_marker_dht(out,0x00,jpg_dc_bits_y,jpg_dc_vals); jpg_marker_dht(out,0x10,jpg_ac_bits_y,jpg_ac_vals_y);
+    jpg_marker_dht(out,0x01,jpg_dc_bits_c,jpg_dc_vals); jpg_marker_dht(out,0x11,jpg_ac_bits_c,jpg_ac_vals_c);
+    static const uint8_t sos[]={ 0xFF,0xDA,0,12,3, 1,0x00, 2,0x11, 3,0x11, 0,63,0 };
+    bv_push(out,sos,sizeof sos);
+
+    JpgBits b={ out,0,0 }; int dcy=0, dcu=0, dcv=0;
+    float Y[4][64], U[64], V[64];
+    for(int my=0;my<h;my+=16) for(int mx=0;mx<w;mx+=16){
+        memset(U,0,sizeof U); memset(V,0,sizeof V);
+        for(int yy=0;yy<16;yy++) for(int xx=0;xx<16;xx++){
+            int sx=mx+xx<w? mx+xx : w-1, sy=my+yy<h? my+yy : h-1; // edge blocks repeat the last pixel
+            const uint8_t *p=rgb+3*((size_t)sy*w+sx); float r=p[0], g=p[1], bl=p[2];
+            Y[(yy>>3)*2+(xx>>3)][(yy&7)*8+(xx&7)] = 0.299f*r+0.587f*g+0.114f*bl-128.0f;
+            int k=(yy>>1)*8+(xx>>1);
+            U[k] += 0.25f*(-0.168736f*r-0.331264f*g+0.5f*bl);
+            V[k] += 0.25f*(0.5f*r-0.418688f*g-0.081312f*bl);
         }
-    } return out;
+        for(int i=0;i<4;i++) dcy=jpg_block(&b,Y[i],T->fd_y,dcy,&T->dc_y,&T->ac_y);
+        dcu=jpg_block(&b,U,T->fd_c,dcu,&T->dc_c,&T->ac_c);
+        dcv=jpg_block(&b,V,T->fd_c,dcv,&T->dc_c,&T->ac_c);
+    }
+    jpg_put(&b,0x7F,7); // pad the last byte with 1s
+    static const uint8_t eoi[]={ 0xFF,0xD9 }; bv_push(out,eoi,2);
+}
+
+// Stats --------------------------------------------------------------------------
+// Counters and per-stage latencies for stats_path. Counters the transmit thread
+// writes (sent, usb_*, tx_*) go through STAT_ADD/STAT_SET/STAT_GET; the rest
+// belong to the render thread. The sample windows are shared and go through mu;
+// the last STAT_WINDOW samples of each feed the exported quantiles.
+enum { ST_METRICS=0, ST_DRAW, ST_ENCODE, ST_SEND, ST_FRAME, N_STAGES };
+static const char *const g_stage_names[N_STAGES]={ "metrics", "draw", "encode", "send", "frame" };
+#define STAT_WINDOW 512
+typedef struct { uint32_t v[STAT_WINDOW]; uint64_t n, sum; } StatWin; // us
+typedef struct {
+    pthread_mutex_t mu;
+    uint64_t rendered, reused, sent, skipped; // frames
+    uint64_t usb_retries, usb_clear_halts, usb_resets, usb_reopens, usb_failures;
+    uint64_t usb_bytes;                     // bytes handed to the endpoint (full packets)
+    StatWin stage[N_STAGES];
+    uint64_t fps_sent, fps_ms; double fps;  // effective fps over the last export interval
+    // Pacing, measured when a send completes
+    StatWin interval;                       // completion to completion
+    StatWin jitter;                         // |interval - frame period|
+    StatWin present;                        // APNG: completion - when the newly shown frame was due
+    uint64_t apng_dropped;                  // APNG frames that were never shown (render thread)
+    uint64_t tx_minflt, tx_majflt;          // page faults in the transmit thread
+    time_t started;
+} Stats;
+static Stats g_stats = { .mu=PTHREAD_MUTEX_INITIALIZER };
+#define STAT_ADD(f,n) __atomic_fetch_add(&g_stats.f,(uint64_t)(n),__ATOMIC_RELAXED)
+#define STAT_SET(f,v) __atomic_store_n(&g_stats.f,(v),__ATOMIC_RELAXED)
+#define STAT_GET(f)   __atomic_load_n(&g_stats.f,__ATOMIC_RELAXED)
+// Caller holds g_stats.mu
+static void win_add(StatWin *w, uint64_t us){
+    w->v[w->n%STAT_WINDOW]=(uint32_t)(us>UINT32_MAX?UINT32_MAX:us); w->sum+=us; w->n++;
 }
+static void stats_stage(int st, uint64_t us){
+    pthread_mutex_lock(&g_stats.mu); win_add(&g_stats.stage[st],us); pthread_mutex_unlock(&g_stats.mu);
+}
+static int u32_cmp(const void *a, const void *b){ uint32_t x=*(const uint32_t*)a, y=*(const uint32_t*)b; return x<y?-1:x>y; }
+// Sorts a copy of the window in place; q[] = p50, p90, p99, max (0 when empty)
+static size_t win_sorted(StatWin *w, uint32_t q[4]){
+    size_t n = w->n<STAT_WINDOW? (size_t)w->n : STAT_WINDOW;
+    qsort(w->v,n,sizeof w->v[0],u32_cmp);
+    static const double qs[3]={ 0.5, 0.9, 0.99 };
+    for(int i=0;i<3;i++) q[i]= n? w->v[(size_t)(qs[i]*(n-1)+0.5)] : 0;
+    q[3]= n? w->v[n-1] : 0;
+    return n;
+}
+// Closes a stage that began at t (stats, probe, trace span on thread tid); returns now
+static uint64_t stage_end_on(int tid, int st, uint64_t t){
+    uint64_t now=now_monotonic_us();
+    stats_stage(st,now-t);
+    PROBE2(stage, st, now-t);
+    trace_span(tid, "stage", g_stage_names[st], t, st, NULL);
+    return now;
+}
+static uint64_t stage_end(int st, uint64_t t){ return stage_end_on(TID_RENDER,st,t); }
 
 // USB robust sender --------------------------------------------------------------
-static void build_header_fixed(uint8_t hdr[PACK]){
+// fmt=g_dev.pix is a raw frame of frame_len=FRAME_LEN; other fmt values carry a
+// compressed payload of frame_len bytes (see wire_format)
+static void build_header(uint8_t *hdr, uint8_t fmt, uint32_t frame_len){
     memset(hdr,0,PACK);
     hdr[0]=0xDA; hdr[1]=0xDB; hdr[2]=0xDC; hdr[3]=0xDD; // magic
-    hdr[4]=0x02; hdr[5]=0x00;   // ver=2
-    hdr[6]=0x01; hdr[7]=0x00;   // cmd=1
-    hdr[8]=0xF0; hdr[9]=0x00;   // H=240
-    hdr[10]=0x40; hdr[11]=0x01; // W=320
-    hdr[12]=0x02; hdr[13]=0x00; // fmt=2 (RGB565)
-    hdr[22]=0x00; hdr[23]=0x58; hdr[24]=0x02; hdr[25]=0x00; // frame_len = 0x00025800
-    hdr[26]=0x00; hdr[27]=0x00; hdr[28]=0x00; hdr[29]=0x08; // extra
+    hdr[4]=g_dev.ver; hdr[5]=0x00;      // ver
+    hdr[6]=g_dev.cmd; hdr[7]=0x00;      // cmd
+    hdr[8]=(uint8_t)W; hdr[9]=(uint8_t)(W>>8);      // W (240 on the stock panel)
+    hdr[10]=(uint8_t)H; hdr[11]=(uint8_t)(H>>8);    // H (320)
+    hdr[12]=fmt;  hdr[13]=0x00; // fmt (2 = RGB565, or a wire_fmt)
+    hdr[22]=(uint8_t)frame_len; hdr[23]=(uint8_t)(frame_len>>8); hdr[24]=(uint8_t)(frame_len>>16); hdr[25]=(uint8_t)(frame_len>>24); // frame_len LE32
+    memcpy(hdr+26,g_dev.extra,4);       // extra
 }
 static void ctrl_nudge(libusb_device_handle *h, uint16_t wIndex){ (void)h; (void)wIndex; }
 static int pick_iface_and_out_ep(libusb_device_handle *h,int want_iface,int *iface,unsigned char *ep_out){
@@ -1123,94 +2504,1509 @@ static int usb_full_reopen(libusb_context **pctx,libusb_device_handle **ph,int w
     }
     return LIBUSB_ERROR_NO_DEVICE;
 }
+// Active profile: device=<name> from g_profiles, else the entry matching
+// device_vid/device_pid, else the first known panel on the bus (stock panel if
+// none). device_vid/pid, device_size and device_packet then override fields.
+static int select_profile(libusb_context *ctx, const Layout *L){
+    const DeviceProfile *base=NULL;
+    if(strcasecmp(L->device,"auto")!=0){
+        for(int i=0;i<N_PROFILES;i++) if(!strcasecmp(g_profiles[i].name,L->device)) base=&g_profiles[i];
+        if(!base){ fprintf(stderr,"unknown device profile '%s'\n",L->device); return -1; }
+    } else if(L->dev_vid && L->dev_pid){
+        for(int i=0;i<N_PROFILES;i++) if(g_profiles[i].vid==L->dev_vid && g_profiles[i].pid==L->dev_pid) base=&g_profiles[i];
+    } else {
+        libusb_device **list=NULL; ssize_t n=libusb_get_device_list(ctx,&list);
+        for(ssize_t i=0;i<n && !base;i++){
+            struct libusb_device_descriptor dd; if(libusb_get_device_descriptor(list[i],&dd)) continue;
+            for(int k=0;k<N_PROFILES && !base;k++) if(g_profiles[k].vid==dd.idVendor && g_profiles[k].pid==dd.idProduct) base=&g_profiles[k];
+        }
+        if(list) libusb_free_device_list(list,1);
+    }
+    DeviceProfile p = base? *base : g_profiles[0];
+    if(L->dev_vid && L->dev_pid){ p.vid=(uint16_t)L->dev_vid; p.pid=(uint16_t)L->dev_pid; }
+    if(L->dev_w>0 && L->dev_h>0){ p.w=L->dev_w; p.h=L->dev_h; }
+    if(L->dev_packet>0) p.packet=L->dev_packet;
+    if(!base || memcmp(&p,base,sizeof p)) p.name="custom";
+    if(p.w<=0 || p.h<=0 || p.packet<64 || p.packet>PACK_MAX){
+        fprintf(stderr,"device profile: bad size %dx%d or packet %d (64..%d)\n",p.w,p.h,p.packet,PACK_MAX); return -1;
+    }
+    g_dev=p; g_pack565=pack565_for(W,H);
+    return 0;
+}
 static int out512_retry(libusb_context **pctx,libusb_device_handle **ph,int want_iface,int *iface,unsigned char *ep_out,const uint8_t *buf,int len){
-    unsigned char pkt[PACK]; memset(pkt,0,sizeof pkt); if(len>PACK) len=PACK; memcpy(pkt,buf,len);
+    unsigned char pkt[PACK_MAX]; memset(pkt,0,PACK); if(len>PACK) len=PACK; memcpy(pkt,buf,len);
     for(int attempt=0;attempt<4;attempt++){
+        uint64_t t=TRACE_ON()? now_monotonic_us() : 0;
+        PROBE2(usb_submit, PACK, attempt);
         int xfer=0; int r=libusb_interrupt_transfer(*ph,*ep_out,pkt,PACK,&xfer,CL_TIMEOUT);
         if(r==LIBUSB_ERROR_PIPE || r==LIBUSB_ERROR_TIMEOUT) r=libusb_bulk_transfer(*ph,*ep_out,pkt,PACK,&xfer,CL_TIMEOUT);
-        if(r==0 && xfer==PACK) return 0;
-        if(attempt==0){ usb_soft_recover(*ph,*ep_out); usleep(50*1000); }
-        else if(attempt==1){ (void)usb_reset_and_reclaim(*ph,iface,ep_out,want_iface); usleep(150*1000); }
-        else { int rc=usb_full_reopen(pctx,ph,want_iface,iface,ep_out); if(rc) return rc; }
+        PROBE3(usb_complete, r, xfer, attempt);
+        if(t) trace_span(TID_TX, "usb", r==0? "packet" : "packet failed", t, attempt, NULL);
+        if(r==0 && xfer==PACK){ STAT_ADD(usb_bytes,PACK); return 0; }
+        if(attempt<3) STAT_ADD(usb_retries,1);
+        t=TRACE_ON()? now_monotonic_us() : 0;
+        PROBE1(usb_recover, attempt<2? attempt : 2); // 0 clear halt, 1 reset, 2 reopen
+        if(attempt==0){ STAT_ADD(usb_clear_halts,1); usb_soft_recover(*ph,*ep_out); usleep(50*1000); trace_span(TID_TX,"usb","clear halt",t,attempt,NULL); }
+        else if(attempt==1){ STAT_ADD(usb_resets,1); (void)usb_reset_and_reclaim(*ph,iface,ep_out,want_iface); usleep(150*1000); trace_span(TID_TX,"usb","reset",t,attempt,NULL); }
+        else {
+            STAT_ADD(usb_reopens,1); int rc=usb_full_reopen(pctx,ph,want_iface,iface,ep_out);
+            trace_span(TID_TX,"usb","reopen",t,attempt,NULL);
+            if(rc){ STAT_ADD(usb_failures,1); return rc; }
+        }
     }
+    STAT_ADD(usb_failures,1);
     return LIBUSB_ERROR_IO;
 }
+// Header + len payload bytes in PACK-sized packets (the last one zero padded)
+static int send_frame(libusb_context **pctx,libusb_device_handle **ph,int want_iface,int *iface,unsigned char *ep_out,
+                      const uint8_t *hdr,const uint8_t *payload,int len){
+    uint16_t wIndex=(uint16_t)*iface;
+    ctrl_nudge(*ph,wIndex);
+    int rc=out512_retry(pctx,ph,want_iface,iface,ep_out,hdr,PACK);
+    if(rc){ fprintf(stderr,"header send failed rc=%d\n",rc); return rc; }
+    ctrl_nudge(*ph,wIndex);
+    for(int off=0; off<len; off+=PACK){
+        ctrl_nudge(*ph,wIndex);
+        int n=(len-off>=PACK)?PACK:(len-off);
+        rc=out512_retry(pctx,ph,want_iface,iface,ep_out,payload+off,n);
+        if(rc){ fprintf(stderr,"data send failed at off=%d rc=%d\n",off,rc); return rc; }
+        ctrl_nudge(*ph,wIndex);
+    }
+    return 0;
+}
+
+// USB transmit thread -------------------------------------------------------------
+// The render thread hands each encoded frame over and goes on composing the next
+// one while this thread sends it. Only this thread gets tx_sched=fifo|rr (with
+// tx_priority), tx_nice and tx_cpu; tx_mlock=1 locks its stack and the handoff
+// buffers so a send never stalls on a page fault. One frame can wait while
+// another is on the wire; beyond that the render thread blocks.
+#define TX_STACK (256*1024)
+static struct {
+    pthread_t th; pthread_mutex_t mu; pthread_cond_t cv;
+    int running, stop, failed;
+    int pending, inflight;              // slot being handed over / on the wire (-1 = none)
+    uint8_t hdr[2][PACK_MAX]; uint8_t *buf[2]; int len[2], frame[2], period_us[2];
+    uint64_t due_us[2];                 // when its newest APNG frame was due (0 = none new)
+    uint64_t last_us;                   // completion of the previous send
+    libusb_context **pctx; libusb_device_handle **ph; int want_iface, *iface; unsigned char *ep_out;
+    int sched, prio, nice, cpu, mlock, debug;
+    void *stack; size_t locked;
+} g_tx = { .mu=PTHREAD_MUTEX_INITIALIZER, .cv=PTHREAD_COND_INITIALIZER, .pending=-1, .inflight=-1 };
+
+static const char *tx_sched_name(int s){ return s==1? "fifo" : s==2? "rr" : "other"; }
+// Scheduling applies to the calling thread only; failures (no CAP_SYS_NICE,
+// RLIMIT_RTPRIO, offline CPU) are reported and the thread runs as it is
+static void tx_apply_sched(void){
+    if(g_tx.sched){
+        struct sched_param sp={ .sched_priority=g_tx.prio };
+        int pol=g_tx.sched==1? SCHED_FIFO : SCHED_RR;
+        int e=pthread_setschedparam(pthread_self(),pol,&sp);
+        if(e) fprintf(stderr,"[tx] tx_sched=%s priority %d: %s\n", tx_sched_name(g_tx.sched), g_tx.prio, strerror(e));
+    } else if(g_tx.nice!=99){
+        if(setpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid),g_tx.nice)!=0) fprintf(stderr,"[tx] tx_nice=%d: %s\n", g_tx.nice, strerror(errno));
+    }
+    if(g_tx.cpu>=0){
+        cpu_set_t set; CPU_ZERO(&set); CPU_SET(g_tx.cpu,&set);
+        int e=pthread_setaffinity_np(pthread_self(),sizeof set,&set);
+        if(e) fprintf(stderr,"[tx] tx_cpu=%d: %s\n", g_tx.cpu, strerror(e));
+    }
+    if(g_tx.debug){
+        int pol=0; struct sched_param sp={0}; pthread_getschedparam(pthread_self(),&pol,&sp);
+        fprintf(stderr,"[tx] %s prio %d nice %d cpu %d, %zu KiB locked\n", pol==SCHED_FIFO?"fifo":pol==SCHED_RR?"rr":"other",
+                sp.sched_priority, getpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid)), sched_getcpu(), g_tx.locked/1024);
+    }
+}
+static void *tx_main(void *arg){
+    (void)arg;
+    tx_apply_sched();
+    pthread_mutex_lock(&g_tx.mu);
+    for(;;){
+        while(g_tx.pending<0 && !g_tx.stop) pthread_cond_wait(&g_tx.cv,&g_tx.mu);
+        if(g_tx.pending<0) break; // stopping and drained
+        int k=g_tx.pending; g_tx.pending=-1; g_tx.inflight=k;
+        pthread_cond_broadcast(&g_tx.cv);
+        pthread_mutex_unlock(&g_tx.mu);
+
+        uint64_t t=now_monotonic_us();
+        int rc=send_frame(g_tx.pctx,g_tx.ph,g_tx.want_iface,g_tx.iface,g_tx.ep_out,g_tx.hdr[k],g_tx.buf[k],g_tx.len[k]);
+        uint64_t done=stage_end_on(TID_TX,ST_SEND,t);
+        if(!rc){
+            pthread_mutex_lock(&g_stats.mu);
+            if(g_tx.last_us){
+                win_add(&g_stats.interval,done-g_tx.last_us);
+                if(g_tx.period_us[k]>0){ int64_t d=(int64_t)(done-g_tx.last_us)-g_tx.period_us[k]; win_add(&g_stats.jitter,(uint64_t)(d<0?-d:d)); }
+            }
+            if(g_tx.due_us[k]) win_add(&g_stats.present, done>g_tx.due_us[k]? done-g_tx.due_us[k] : 0);
+            pthread_mutex_unlock(&g_stats.mu);
+            g_tx.last_us=done;
+        }
+        PROBE2(frame_end, g_tx.frame[k], g_tx.len[k]);
+        struct rusage ru; if(getrusage(RUSAGE_THREAD,&ru)==0){ STAT_SET(tx_minflt,(uint64_t)ru.ru_minflt); STAT_SET(tx_majflt,(uint64_t)ru.ru_majflt); }
+
+        pthread_mutex_lock(&g_tx.mu);
+        g_tx.inflight=-1;
+        if(rc){ g_tx.failed=1; pthread_cond_broadcast(&g_tx.cv); break; }
+        STAT_ADD(sent,1);
+        pthread_cond_broadcast(&g_tx.cv);
+    }
+    pthread_mutex_unlock(&g_tx.mu);
+    return NULL;
+}
+// Starts the thread; it owns the USB handle until tx_stop()
+static void tx_start(const Layout *L, libusb_context **pctx, libusb_device_handle **ph, int *iface, unsigned char *ep_out){
+    g_tx.pctx=pctx; g_tx.ph=ph; g_tx.want_iface=L->iface; g_tx.iface=iface; g_tx.ep_out=ep_out;
+    g_tx.sched=L->tx_sched; g_tx.prio=L->tx_priority; g_tx.nice=L->tx_nice; g_tx.cpu=L->tx_cpu; g_tx.mlock=L->tx_mlock; g_tx.debug=L->debug;
+    g_tx.stop=g_tx.failed=0; g_tx.pending=g_tx.inflight=-1; g_tx.last_us=0; g_tx.locked=0;
+    for(int k=0;k<2;k++){ g_tx.buf[k]=(uint8_t*)malloc(FRAME_LEN); if(!g_tx.buf[k]) die("malloc tx buffer"); }
+    pthread_attr_t at; pthread_attr_init(&at);
+    if(g_tx.mlock){
+        // Own stack so it can be locked (mlock also faults every page in)
+        if(posix_memalign(&g_tx.stack,4096,TX_STACK)!=0) die("alloc tx stack");
+        pthread_attr_setstack(&at,g_tx.stack,TX_STACK);
+        if(mlock(g_tx.stack,TX_STACK)==0) g_tx.locked+=TX_STACK;
+        else fprintf(stderr,"[tx] mlock stack: %s (raise LimitMEMLOCK / ulimit -l)\n", strerror(errno));
+        for(int k=0;k<2;k++){
+            if(mlock(g_tx.buf[k],FRAME_LEN)==0) g_tx.locked+=FRAME_LEN;
+            else fprintf(stderr,"[tx] mlock buffer: %s\n", strerror(errno));
+        }
+    }
+    int e=pthread_create(&g_tx.th,&at,tx_main,NULL);
+    if(e){ errno=e; die("pthread_create tx"); }
+    pthread_attr_destroy(&at);
+    g_tx.running=1;
+}
+// Queues a frame (copied). Blocks while another frame is already queued.
+// -1 once the thread has given up on the device.
+static int tx_submit(const uint8_t *hdr, const uint8_t *payload, int len, int frame, int period_ms, uint64_t due_us){
+    pthread_mutex_lock(&g_tx.mu);
+    while(g_tx.pending>=0 && !g_tx.failed) pthread_cond_wait(&g_tx.cv,&g_tx.mu);
+    int k=g_tx.inflight==0? 1 : 0, failed=g_tx.failed;
+    pthread_mutex_unlock(&g_tx.mu);
+    if(failed) return -1;
+    // Slot k is neither queued nor on the wire, so it can be filled unlocked
+    memcpy(g_tx.hdr[k],hdr,PACK); memcpy(g_tx.buf[k],payload,(size_t)len);
+    g_tx.len[k]=len; g_tx.frame[k]=frame; g_tx.period_us[k]=period_ms*1000; g_tx.due_us[k]=due_us;
+    pthread_mutex_lock(&g_tx.mu);
+    g_tx.pending=k; pthread_cond_broadcast(&g_tx.cv);
+    pthread_mutex_unlock(&g_tx.mu);
+    return 0;
+}
+// Sends whatever is queued, joins the thread and frees its buffers; -1 if a send failed
+static int tx_stop(void){
+    if(!g_tx.running) return 0;
+    pthread_mutex_lock(&g_tx.mu); g_tx.stop=1; pthread_cond_broadcast(&g_tx.cv); pthread_mutex_unlock(&g_tx.mu);
+    pthread_join(g_tx.th,NULL); g_tx.running=0;
+    for(int k=0;k<2;k++){ if(g_tx.mlock) munlock(g_tx.buf[k],FRAME_LEN); free(g_tx.buf[k]); g_tx.buf[k]=NULL; }
+    if(g_tx.stack){ munlock(g_tx.stack,TX_STACK); free(g_tx.stack); g_tx.stack=NULL; }
+    return g_tx.failed? -1 : 0;
+}
+
+// Wire format probe ---------------------------------------------------------------
+// The panel gives no feedback beyond the USB transfer status, so every candidate
+// fmt gets a JPEG test card held on screen for a while: colour bars on top and
+// <fmt> white boxes below. The fmt whose card shows up intact is the one to put
+// in wire_fmt=. A black RGB565 frame goes out between candidates.
+static void probe_card(uint8_t *rgb, int fmt){
+    static const uint8_t bars[8][3]={ {255,255,255},{255,255,0},{0,255,255},{0,255,0},{255,0,255},{255,0,0},{0,0,255},{0,0,0} };
+    static const uint8_t grey[3]={ 40,40,40 }, white[3]={ 255,255,255 };
+    int box=W/12, step=box+box/4, top=H*2/3;
+    for(int y=0;y<H;y++) for(int x=0;x<W;x++){
+        const uint8_t *c = y<top? bars[x*8/W] : grey;
+        int i=((y-top-box/2)/step)*8 + (x-box/2)/step;
+        if(y>=top+box/2 && x>=box/2 && (x-box/2)%step<box && (y-top-box/2)%step<box && (x-box/2)/step<8 && i<fmt) c=white;
+        memcpy(rgb+3*((size_t)y*W+x),c,3);
+    }
+}
+static int wire_probe(libusb_context **pctx,libusb_device_handle **ph,int want_iface,int *iface,unsigned char *ep_out,const Layout *L){
+    uint8_t *rgb=(uint8_t*)malloc((size_t)W*H*3), *black=(uint8_t*)calloc(FRAME_LEN,1);
+    if(!rgb||!black) die("malloc probe");
+    ByteVec jpg; bv_init(&jpg); JpgTables T; jpg_tables_init(&T,L->jpeg_quality);
+    uint8_t hdr565[PACK_MAX], hdr[PACK_MAX]; build_header(hdr565,(uint8_t)g_dev.pix,FRAME_LEN);
+    char list[128]; snprintf(list,sizeof list,"%s",L->wire_probe_fmts);
+    int rc=0;
+    for(char *save=NULL, *tok=strtok_r(list,", ",&save); tok && !g_stop; tok=strtok_r(NULL,", ",&save)){
+        int fmt=atoi(tok); if(fmt<0||fmt>255||fmt==(int)g_dev.pix) continue;
+        if((rc=send_frame(pctx,ph,want_iface,iface,ep_out,hdr565,black,FRAME_LEN))!=0) break;
+        usleep(300*1000);
+        probe_card(rgb,fmt); jpeg_encode_rgb(&jpg,rgb,W,H,&T);
+        build_header(hdr,(uint8_t)fmt,(uint32_t)jpg.size);
+        int r=send_frame(pctx,ph,want_iface,iface,ep_out,hdr,jpg.data,(int)jpg.size);
+        fprintf(stderr,"[probe] fmt=%d: %zu-byte JPEG %s\n", fmt, jpg.size, r? "failed on the wire" : "sent, watch the panel");
+        usleep((useconds_t)(L->wire_probe_hold_ms>0? L->wire_probe_hold_ms : 0)*1000);
+    }
+    if(!rc) fprintf(stderr,"[probe] done. If a card with colour bars and N white boxes appeared, set wire_format=jpeg and wire_fmt=N.\n");
+    bv_free(&jpg); free(rgb); free(black);
+    return rc;
+}
+
+// Last-frame snapshot ------------------------------------------------------------
+// 16-byte header ("TRLCDSN1", u16 W, u16 H, u32 length, little endian) + the
+// RGB565 payload exactly as sent. Written to <path>.tmp and renamed over the
+// old one, so a crash leaves either the previous or the new frame.
+#define SNAP_HDR 16
+static void snapshot_header(uint8_t h[SNAP_HDR]){
+    memcpy(h,"TRLCDSN1",8);
+    h[8]=(uint8_t)W; h[9]=(uint8_t)(W>>8); h[10]=(uint8_t)H; h[11]=(uint8_t)(H>>8);
+    h[12]=(uint8_t)FRAME_LEN; h[13]=(uint8_t)(FRAME_LEN>>8); h[14]=(uint8_t)(FRAME_LEN>>16); h[15]=(uint8_t)(FRAME_LEN>>24);
+}
+static int snapshot_load(const char *path, uint8_t *rgb565){
+    FILE *f=fopen(path,"rb"); if(!f) return -1;
+    uint8_t want[SNAP_HDR], got[SNAP_HDR]; snapshot_header(want);
+    int ok = fread(got,1,SNAP_HDR,f)==SNAP_HDR && !memcmp(got,want,SNAP_HDR)
+          && fread(rgb565,1,FRAME_LEN,f)==FRAME_LEN && fgetc(f)==EOF;
+    fclose(f);
+    if(!ok){ fprintf(stderr,"snapshot %s: wrong size or panel geometry, ignored\n", path); return -1; }
+    return 0;
+}
+static int snapshot_save(const char *path, const uint8_t *rgb565){
+    char tmp[600]; snprintf(tmp,sizeof tmp,"%s.tmp",path);
+    int fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    if(fd<0){ fprintf(stderr,"snapshot %s: %s\n", tmp, strerror(errno)); return -1; }
+    uint8_t h[SNAP_HDR]; snapshot_header(h);
+    const uint8_t *parts[2]={ h, rgb565 }; size_t lens[2]={ SNAP_HDR, FRAME_LEN };
+    int rc=0;
+    for(int i=0;i<2 && !rc;i++){
+        size_t off=0;
+        while(off<lens[i]){
+            ssize_t n=write(fd,parts[i]+off,lens[i]-off);
+            if(n<0){ if(errno==EINTR) continue; rc=-1; break; }
+            off+=(size_t)n;
+        }
+    }
+    if(!rc && fsync(fd)!=0) rc=-1;
+    if(close(fd)!=0) rc=-1;
+    if(!rc && rename(tmp,path)!=0) rc=-1;
+    if(rc){ fprintf(stderr,"snapshot %s: %s\n", path, strerror(errno)); unlink(tmp); }
+    return rc;
+}
+static uint64_t fnv1a64(const uint8_t *p, size_t n){
+    uint64_t h=1469598103934665603ull;
+    for(size_t i=0;i<n;i++){ h^=p[i]; h*=1099511628211ull; }
+    return h;
+}
+
+// Pixel RLE (compressed asset cache) ---------------------------------------------
+// Stream of 16-bit LE control words over 32-bit pixels:
+//   bit15 set   -> run of (ctl&0x7FFF)+1 copies of the following pixel
+//   bit15 clear -> (ctl+1) literal pixels follow
+// Cheap enough to decode per frame; transparent/flat UI art shrinks a lot.
+static void rle_encode(ByteVec *out, const uint8_t *px, size_t n){
+    size_t i=0;
+    while(i<n){
+        uint32_t p; memcpy(&p,px+4*i,4);
+        size_t r=1; while(i+r<n && r<0x8000 && !memcmp(px+4*(i+r),&p,4)) r++;
+        if(r>=2){
+            uint16_t ctl=(uint16_t)(0x8000|(r-1)); unsigned char c[2]={ (unsigned char)ctl, (unsigned char)(ctl>>8) };
+            bv_push(out,c,2); bv_push(out,&p,4); i+=r; continue;
+        }
+        size_t j=i+1; // literal until the next pair of equal pixels
+        while(j<n && j-i<0x8000 && !(j+1<n && !memcmp(px+4*j,px+4*(j+1),4))) j++;
+        uint16_t ctl=(uint16_t)(j-i-1); unsigned char c[2]={ (unsigned char)ctl, (unsigned char)(ctl>>8) };
+        bv_push(out,c,2); bv_push(out,px+4*i,4*(j-i)); i=j;
+    }
+}
+static int rle_decode(const unsigned char *in, size_t len, uint8_t *px, size_t n){
+    size_t i=0, o=0;
+    while(i+2<=len && o<n){
+        unsigned ctl=in[i]|(in[i+1]<<8); i+=2; size_t cnt=(ctl&0x7FFF)+1;
+        if(o+cnt>n) return -1;
+        if(ctl&0x8000){
+            if(i+4>len) return -1;
+            uint32_t p; memcpy(&p,in+i,4); i+=4;
+            for(size_t k=0;k<cnt;k++) memcpy(px+4*(o+k),&p,4);
+        } else {
+            if(i+4*cnt>len) return -1;
+            memcpy(px+4*o,in+i,4*cnt); i+=4*cnt;
+        }
+        o+=cnt;
+    }
+    return (o==n)? 0 : -1;
+}
 
 // Asset cache: background + images (static or APNG) ------------------------------
+// Assets are decoded on a loader thread the first time they are drawn; until
+// then the layer shows a placeholder. Each asset is kept in one of three forms:
+//   raw    - every frame decoded (fastest to draw)
+//   rle    - frames kept RLE-compressed, decoded into a shared scratch per draw
+//   stream - only the file bytes; APNG frames are composed on demand
+// storage=auto picks raw while memory_budget_mb allows it, then rle, then
+// stream. Over budget, the least recently drawn assets are evicted: raw ones
+// down to an RLE copy (or re-read from disk when RLE doesn't pay off), the
+// others entirely.
+//
+// Ownership: pixel data of an asset is only touched by the loader thread while
+// the asset is QUEUED/EVICTING and only by the render thread while READY.
+// State changes and the byte counters are guarded by g_am.mu.
+typedef enum { AS_UNLOADED=0, AS_QUEUED, AS_READY, AS_EVICTING, AS_EVICTED, AS_FAILED } AssetState;
+typedef struct { unsigned char **frame; size_t *len; unsigned n; size_t bytes; } RleCache;
+
 typedef struct {
     int is_anim; ApngAnim anim; ImageRGBA stat;
-    int loaded;
+    char *path; int rotate180;
+    int pinned;         // never evicted (background)
+    int opaque;         // every frame fully opaque (copy blit)
+    AssetStore want_store, store;
+    AssetState state;
+    int want;           // drawn again while being evicted: reload right after
+    size_t bytes;       // resident bytes (raw frames, primary RLE or stream state)
+    RleCache rle;       // primary (store=rle) or cached copy of raw frames
+    ApngDecoder *stream; unsigned stream_idx; const uint8_t *stream_frame;
+    uint64_t last_used_ms; int used_frame;
+    int peek_w, peek_h; // IHDR size for the placeholder (0 if unknown)
+    uint8_t *preview;   // first APNG frame, shown until the rest is decoded
+    int preview_w, preview_h, preview_done;
     // playback knobs
     double speed; int64_t start_ms; int loop_mode; int loop_N;
+    int resample; double resample_ms; // apng_resample: 1 nearest, 2 blend; output frame length (animation ms, 0 = off)
+    unsigned src_frames;              // frames in the file when resampled, else 0
 } Asset;
 
+typedef struct {
+    pthread_mutex_t mu; pthread_cond_t cv, idle_cv;
+    pthread_t th; int started, stop, busy;
+    Asset **q; int qn, qcap;
+    Asset **all; int n_all;
+    size_t budget;      // bytes, 0 = unlimited
+    size_t resident;    // sum of Asset.bytes over READY assets
+    size_t cached;      // RLE copies kept for raw assets (resident or evicted)
+    int debug;
+    // shared decode target for rle assets (render thread only)
+    uint8_t *scratch; size_t scratch_cap; const Asset *scratch_owner; unsigned scratch_idx;
+} AssetMgr;
+static AssetMgr g_am = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void asset_enqueue_locked(Asset *a){
+    if(g_am.qn==g_am.qcap){ g_am.qcap=g_am.qcap?g_am.qcap*2:16; g_am.q=(Asset**)realloc(g_am.q,g_am.qcap*sizeof(Asset*)); if(!g_am.q) die("realloc asset queue"); }
+    g_am.q[g_am.qn++]=a; g_am.busy=1; pthread_cond_signal(&g_am.cv);
+}
+static size_t asset_frame_px(const Asset *a){
+    return a->is_anim? (size_t)a->anim.canvas_w*a->anim.canvas_h : (size_t)a->stat.w*a->stat.h;
+}
+static size_t asset_raw_bytes(const Asset *a){
+    return (a->is_anim? a->anim.num_frames : 1) * asset_frame_px(a) * 4;
+}
+static size_t apng_dec_bytes(const ApngDecoder *D){
+    size_t c=(size_t)D->canvas_w*D->canvas_h*4;
+    return D->filesize + (D->canvas?c:0) + (D->canvas_prev?c:0) + (D->out?c:0) + D->header_chunks.cap + D->cur.idata.cap;
+}
+static size_t asset_resident_bytes(const Asset *a){
+    if(a->store==STORE_RLE) return a->rle.bytes;
+    if(a->store==STORE_STREAM) return a->stream? apng_dec_bytes(a->stream) : 0;
+    return asset_raw_bytes(a);
+}
+static void rle_free(RleCache *c){
+    for(unsigned i=0;i<c->n;i++) free(c->frame[i]);
+    free(c->frame); free(c->len); memset(c,0,sizeof *c);
+}
+static void rle_push(RleCache *c, const uint8_t *px, size_t npx){
+    c->frame=(unsigned char**)realloc(c->frame,(c->n+1)*sizeof(unsigned char*));
+    c->len=(size_t*)realloc(c->len,(c->n+1)*sizeof(size_t));
+    if(!c->frame||!c->len) die("realloc rle");
+    ByteVec v; bv_init(&v); rle_encode(&v,px,npx);
+    c->frame[c->n]=v.data; c->len[c->n]=v.size; c->bytes+=v.size; c->n++;
+}
+static void asset_free_pixels(Asset *a){
+    if(a->is_anim){ if(a->anim.frame_rgba){ for(unsigned i=0;i<a->anim.num_frames;i++) free(a->anim.frame_rgba[i]); free(a->anim.frame_rgba); a->anim.frame_rgba=NULL; } }
+    else if(a->stat.rgba){ stbi_image_free(a->stat.rgba); a->stat.rgba=NULL; }
+    if(a->stream){ apng_dec_close(a->stream); free(a->stream); a->stream=NULL; a->stream_frame=NULL; }
+    if(a->store==STORE_RLE) rle_free(&a->rle);
+}
 static void asset_free(Asset *a){
     if(!a) return;
+    asset_free_pixels(a);
     if(a->is_anim) apnganim_free(&a->anim);
     else free_imgrgba(&a->stat);
+    rle_free(&a->rle); free(a->path); free(a->preview);
+    memset(a,0,sizeof *a);
+}
+static void asset_init(Asset *a, const char *path, int rotate180, int storage, double speed, int64_t start_ms, int loop_mode, int loop_N){
     memset(a,0,sizeof *a);
+    a->path=strdup(path); if(!a->path) die("strdup asset");
+    a->rotate180=rotate180; a->want_store=(AssetStore)storage;
+    a->speed=speed; a->start_ms=start_ms; a->loop_mode=loop_mode; a->loop_N=loop_N;
+    a->used_frame=-1;
+    g_am.all=(Asset**)realloc(g_am.all,(g_am.n_all+1)*sizeof(Asset*));
+    if(!g_am.all) die("realloc assets"); g_am.all[g_am.n_all++]=a;
+}
+// Hands the first frame to the render thread while the rest decodes. The render
+// thread owns it from then on and frees it once the asset is READY; an old one
+// still around (never drawn after loading) is kept, it shows the same frame.
+static void asset_publish_preview(Asset *a, const uint8_t *frame, int w, int h){
+    pthread_mutex_lock(&g_am.mu); int have=a->preview!=NULL; pthread_mutex_unlock(&g_am.mu);
+    if(have) return;
+    size_t sz=(size_t)w*h*4; uint8_t *p=(uint8_t*)malloc(sz); if(!p) die("malloc preview");
+    memcpy(p,frame,sz);
+    pthread_mutex_lock(&g_am.mu); a->preview=p; a->preview_w=w; a->preview_h=h; pthread_mutex_unlock(&g_am.mu);
+    startup_mark("preview %s", a->path);
+}
+// Room left under the budget (SIZE_MAX when unlimited)
+static size_t asset_budget_left(void){
+    pthread_mutex_lock(&g_am.mu);
+    size_t used=g_am.resident+g_am.cached;
+    size_t left = !g_am.budget? SIZE_MAX : (used>=g_am.budget? 0 : g_am.budget-used);
+    pthread_mutex_unlock(&g_am.mu);
+    return left;
+}
+
+// Loader thread side -------------------------------------------------------------
+static int asset_decode_static(Asset *a){
+    ImageRGBA s = load_png_rgba_stb(a->path); if(!s.rgba) return -1;
+    if(a->rotate180) rotate180_rgba(s.rgba, s.w, s.h);
+    a->is_anim=0; a->stat=s; a->store=STORE_RAW;
+    a->opaque=rgba_opaque(s.rgba,(size_t)s.w*s.h);
+    size_t raw=(size_t)s.w*s.h*4;
+    // stream makes no sense for a single image: it falls back to rle
+    if(a->want_store==STORE_RLE || a->want_store==STORE_STREAM || (a->want_store==STORE_AUTO && raw>asset_budget_left())){
+        rle_push(&a->rle, s.rgba, (size_t)s.w*s.h);
+        stbi_image_free(a->stat.rgba); a->stat.rgba=NULL; a->store=STORE_RLE;
+    }
+    return 0;
+}
+static void asset_push_frame(Asset *a, AssetStore st, const uint8_t *fr, unsigned ms){
+    ApngAnim *A=&a->anim;
+    if(st==STORE_RAW){ apnganim_push(A,fr,ms); return; }
+    rle_push(&a->rle,fr,asset_frame_px(a));
+    A->delay_ms=(unsigned*)realloc(A->delay_ms,(A->num_frames+1)*sizeof(unsigned)); if(!A->delay_ms) die("realloc delays");
+    A->delay_ms[A->num_frames++]=ms; A->total_ms+=ms;
+}
+// apng_resample: frames are re-timed to the panel's frame length P while they
+// are decoded. Output frame k covers [round(k*P), round((k+1)*P)) ms of the
+// loop, the last one cut at its end, so total_ms and looping stay the same.
+// nearest keeps the source frame showing at the middle of each output frame
+// (the first one that covers it if the middle is past the end); blend
+// averages the source frames over it, weighted by how long each shows.
+typedef struct {
+    double period; int blend; size_t n;  // n: bytes per frame
+    uint32_t *acc; uint8_t *out;
+    uint64_t t;                          // source time fed so far, ms
+    unsigned k, w;                       // output frame being built, ms of it covered
+} Resampler;
+static uint64_t rs_edge(const Resampler *R, unsigned k){ return (uint64_t)llround(k*R->period); }
+// Dry pass over the chunks (no pixels) for the frame count and loop length;
+// leaves D rewound. Returns the output frame count, or 0 when resampling
+// wouldn't drop any frames (the panel is as fast as the animation).
+static unsigned rs_plan(Resampler *R, ApngDecoder *D, double period, int blend, size_t fsz){
+    const uint8_t *fr; unsigned ms, n=0; uint64_t total=0;
+    memset(R,0,sizeof *R);
+    apng_dec_rewind(D); D->dry=1;
+    while(apng_dec_next(D,&fr,&ms)==1){ n++; total+=ms; }
+    D->dry=0; apng_dec_rewind(D);
+    R->period=period; R->blend=blend; R->n=fsz;
+    unsigned nout=0; while(rs_edge(R,nout)<total) nout++;
+    if(nout==0 || nout>=n) return 0;
+    R->out=(uint8_t*)malloc(fsz); if(!R->out) die("malloc resample");
+    if(blend && !(R->acc=(uint32_t*)calloc(fsz,sizeof(uint32_t)))) die("calloc resample");
+    return nout;
+}
+static void rs_flush(Resampler *R, Asset *a, AssetStore st){
+    if(!R->w) return;
+    if(R->blend) for(size_t i=0;i<R->n;i++){ R->out[i]=(uint8_t)((R->acc[i]+R->w/2)/R->w); R->acc[i]=0; }
+    asset_push_frame(a,st,R->out,R->w);
+    R->w=0; R->k++;
+}
+static void rs_feed(Resampler *R, Asset *a, AssetStore st, const uint8_t *fr, unsigned ms){
+    uint64_t s0=R->t, s1=R->t+ms; R->t=s1;
+    while(s0<s1){
+        uint64_t b0=rs_edge(R,R->k), b1=rs_edge(R,R->k+1), e = s1<b1? s1 : b1, mid=(b0+b1)/2;
+        unsigned ov=(unsigned)(e-s0);
+        if(R->blend) for(size_t i=0;i<R->n;i++) R->acc[i]+=fr[i]*ov;
+        else if(!R->w || (mid>=s0 && mid<e)) memcpy(R->out,fr,R->n);
+        R->w+=ov; s0=e;
+        if(e==b1) rs_flush(R,a,st);
+    }
+}
+static void rs_free(Resampler *R){ free(R->acc); free(R->out); R->acc=NULL; R->out=NULL; }
+// Keeps the decoder for on-demand composition; the frame table (delays) comes
+// from a dry pass over the chunks, which doesn't decode any pixels.
+static int asset_setup_stream(Asset *a, ApngDecoder *D){
+    const uint8_t *fr; unsigned ms; int rc;
+    apng_dec_rewind(D); D->dry=1;
+    while((rc=apng_dec_next(D,&fr,&ms))==1){
+        a->anim.delay_ms=(unsigned*)realloc(a->anim.delay_ms,(a->anim.num_frames+1)*sizeof(unsigned));
+        if(!a->anim.delay_ms) die("realloc delays");
+        a->anim.delay_ms[a->anim.num_frames++]=ms; a->anim.total_ms+=ms;
+    }
+    D->dry=0; apng_dec_rewind(D);
+    if(a->anim.num_frames==0) return -1;
+    if(apng_dec_next(D,&a->stream_frame,&ms)!=1) return -1;
+    a->stream=(ApngDecoder*)malloc(sizeof *D); if(!a->stream) die("malloc stream");
+    *a->stream=*D; a->stream_idx=0; a->store=STORE_STREAM; a->opaque=0; // takes over D's buffers
+    return 0;
+}
+static int asset_decode_from_disk(Asset *a){
+    if(a->is_anim) apnganim_free(&a->anim); // metadata left over from an eviction
+    a->is_anim=0;
+    ApngDecoder D; if(apng_dec_open(&D,a->path,a->rotate180)!=0) return -1;
+    const uint8_t *fr; unsigned ms;
+    int rc=apng_dec_next(&D,&fr,&ms);
+    if(rc<0){ apng_dec_close(&D); return -1; }
+    if(rc==0 || !D.saw_acTL){ apng_dec_close(&D); return asset_decode_static(a); }
+
+    ApngAnim *A=&a->anim; memset(A,0,sizeof *A);
+    A->is_apng=1; A->plays=D.plays; A->canvas_w=D.canvas_w; A->canvas_h=D.canvas_h; a->is_anim=1;
+    size_t fsz=(size_t)D.canvas_w*D.canvas_h*4;
+    asset_publish_preview(a, fr, (int)D.canvas_w, (int)D.canvas_h);
+    size_t left=asset_budget_left();
+    AssetStore st=a->want_store;
+    // stream composes frames on demand: played as they are in the file
+    Resampler rs; unsigned nout=0; a->src_frames=0;
+    if(a->resample_ms>0 && st!=STORE_STREAM){
+        nout=rs_plan(&rs,&D,a->resample_ms,a->resample==2,fsz); // rewinds D
+        if(apng_dec_next(&D,&fr,&ms)!=1){ rs_free(&rs); apng_dec_close(&D); return -1; }
+    }
+    if(st==STORE_AUTO) st = (size_t)(nout? nout : D.acTL_frames?D.acTL_frames:1)*fsz <= left ? STORE_RAW : STORE_RLE;
+    if(st==STORE_STREAM){ int r=asset_setup_stream(a,&D); if(r) apng_dec_close(&D); return r; }
+
+    a->store=st; a->opaque=1;
+    unsigned src=0;
+    do{
+        if(a->opaque) a->opaque=rgba_opaque(fr,fsz/4);
+        if(nout) rs_feed(&rs,a,st,fr,ms); else asset_push_frame(a,st,fr,ms);
+        src++;
+        if(st==STORE_RLE && a->want_store==STORE_AUTO && a->rle.bytes>left){
+            // even compressed it doesn't fit: compose frames on demand instead
+            rle_free(&a->rle); free(A->delay_ms); A->delay_ms=NULL; A->num_frames=0; A->total_ms=0;
+            if(nout) rs_free(&rs);
+            int r=asset_setup_stream(a,&D); if(r) apng_dec_close(&D); return r;
+        }
+    } while((rc=apng_dec_next(&D,&fr,&ms))==1);
+    apng_dec_close(&D);
+    if(nout){ rs_flush(&rs,a,st); rs_free(&rs); a->src_frames=src; }
+    return A->num_frames? 0 : -1;
+}
+static int asset_decode_from_rle(Asset *a){
+    if(a->is_anim){
+        size_t fsz=asset_frame_px(a)*4;
+        uint8_t **fr=(uint8_t**)calloc(a->anim.num_frames,sizeof(uint8_t*)); if(!fr) die("calloc frames");
+        for(unsigned i=0;i<a->anim.num_frames;i++){
+            fr[i]=(uint8_t*)malloc(fsz); if(!fr[i]) die("malloc frame");
+            if(rle_decode(a->rle.frame[i],a->rle.len[i],fr[i],fsz/4)!=0){ for(unsigned k=0;k<=i;k++) free(fr[k]); free(fr); return -1; }
+        }
+        a->anim.frame_rgba=fr; return 0;
+    }
+    size_t n=asset_frame_px(a);
+    uint8_t *px=(uint8_t*)malloc(n*4); if(!px) die("malloc image");
+    if(rle_decode(a->rle.frame[0],a->rle.len[0],px,n)!=0){ free(px); return -1; }
+    a->stat.rgba=px; return 0;
+}
+static void asset_build_rle(Asset *a){
+    unsigned n=a->is_anim? a->anim.num_frames : 1;
+    RleCache c={0};
+    for(unsigned i=0;i<n;i++) rle_push(&c, a->is_anim? a->anim.frame_rgba[i] : a->stat.rgba, asset_frame_px(a));
+    // not worth keeping unless it saves at least a quarter: re-read from disk instead
+    if(c.bytes*4 > asset_raw_bytes(a)*3){ rle_free(&c); return; }
+    a->rle=c;
+}
+static void asset_do_load(Asset *a){
+    int from_rle = a->store==STORE_RAW && a->rle.n>0; // raw asset evicted to its RLE copy
+    int rc = from_rle? asset_decode_from_rle(a) : asset_decode_from_disk(a);
+    pthread_mutex_lock(&g_am.mu);
+    if(rc!=0){ a->state=AS_FAILED; fprintf(stderr,"Failed to load asset: %s\n", a->path); }
+    else {
+        a->bytes=asset_resident_bytes(a); g_am.resident+=a->bytes; a->state=AS_READY;
+        if(a->is_anim && !from_rle)
+            fprintf(stderr,"[APNG] %s: %u frames%s, plays=%u, total=%ums\n", a->path, a->anim.num_frames,
+                    a->src_frames? (a->resample==2? " (blended to fps)" : " (resampled to fps)") : "", a->anim.plays, a->anim.total_ms);
+        if(g_am.debug) fprintf(stderr,"[asset] loaded %s (%s, %zu KiB%s)\n", a->path, store_name(a->store), a->bytes/1024, from_rle?", from cache":"");
+        startup_mark("ready %s", a->path);
+    }
+    pthread_mutex_unlock(&g_am.mu);
+}
+static void asset_do_evict(Asset *a){
+    size_t copy=0; // a copy kept from an earlier eviction is already counted
+    if(a->store==STORE_RAW && a->rle.n==0){ asset_build_rle(a); copy=a->rle.bytes; }
+    asset_free_pixels(a);
+    pthread_mutex_lock(&g_am.mu);
+    g_am.resident-=a->bytes; g_am.cached+=copy;
+    int keep = a->store==STORE_RAW && a->rle.n;
+    if(g_am.debug) fprintf(stderr,"[asset] evicted %s (%s, %zu KiB%s)\n", a->path, store_name(a->store), a->bytes/1024, keep?" -> rle copy":"");
+    a->bytes=0;
+    if(a->want){ a->want=0; a->state=AS_QUEUED; asset_enqueue_locked(a); }
+    else a->state = keep? AS_EVICTED : AS_UNLOADED;
+    pthread_mutex_unlock(&g_am.mu);
+}
+// Decodes just the first frame of an APNG and sends the asset to the back of
+// the queue, so every animation shows something before any is fully decoded.
+// Anything else (static PNG, cached copy) is loaded completely right away.
+static void asset_do_preview(Asset *a){
+    a->preview_done=1;
+    if(!(a->store==STORE_RAW && a->rle.n>0)){
+        ApngDecoder D; const uint8_t *fr; unsigned ms;
+        if(apng_dec_open(&D,a->path,a->rotate180)==0){
+            int rc=apng_dec_next(&D,&fr,&ms);
+            int anim = rc==1 && D.saw_acTL;
+            if(anim) asset_publish_preview(a,fr,(int)D.canvas_w,(int)D.canvas_h);
+            apng_dec_close(&D);
+            if(anim){ pthread_mutex_lock(&g_am.mu); asset_enqueue_locked(a); pthread_mutex_unlock(&g_am.mu); return; }
+        }
+    }
+    asset_do_load(a);
+}
+static void* asset_loader_main(void *arg){
+    (void)arg;
+    pthread_mutex_lock(&g_am.mu);
+    while(!g_am.stop){
+        if(g_am.qn==0){ g_am.busy=0; pthread_cond_broadcast(&g_am.idle_cv); pthread_cond_wait(&g_am.cv,&g_am.mu); continue; }
+        int k=0; // first-frame previews go before full loads
+        for(int i=0;i<g_am.qn;i++) if(g_am.q[i]->state==AS_QUEUED && !g_am.q[i]->preview_done){ k=i; break; }
+        Asset *a=g_am.q[k]; memmove(g_am.q+k,g_am.q+k+1,(size_t)(g_am.qn-k-1)*sizeof(Asset*)); g_am.qn--;
+        g_am.busy=1; AssetState st=a->state;
+        pthread_mutex_unlock(&g_am.mu);
+        uint64_t t=now_monotonic_us();
+        const char *what = st==AS_EVICTING? "evict" : !a->preview_done? "preview" : "load";
+        PROBE1(asset_begin, a->path);
+        if(st==AS_EVICTING) asset_do_evict(a);
+        else if(!a->preview_done) asset_do_preview(a);
+        else asset_do_load(a);
+        PROBE2(asset_end, a->path, (int)a->state);
+        trace_span(TID_LOADER, "asset", what, t, 0, a->path);
+        pthread_mutex_lock(&g_am.mu);
+    }
+    pthread_mutex_unlock(&g_am.mu);
+    return NULL;
+}
+
+// Render thread side -------------------------------------------------------------
+static void asset_mgr_start(size_t budget_bytes, int debug){
+    g_am.budget=budget_bytes; g_am.debug=debug;
+    if(pthread_create(&g_am.th,NULL,asset_loader_main,NULL)!=0) die("pthread_create loader");
+    g_am.started=1;
+}
+static void asset_mgr_stop(void){
+    if(!g_am.started) return;
+    pthread_mutex_lock(&g_am.mu); g_am.stop=1; pthread_cond_broadcast(&g_am.cv); pthread_mutex_unlock(&g_am.mu);
+    pthread_join(g_am.th,NULL); g_am.started=0;
+    free(g_am.q); g_am.q=NULL; g_am.qn=g_am.qcap=0;
+    free(g_am.all); g_am.all=NULL; g_am.n_all=0;
+    free(g_am.scratch); g_am.scratch=NULL; g_am.scratch_cap=0; g_am.scratch_owner=NULL;
+}
+// Marks the asset as drawn this frame; returns 1 if its pixels can be used now,
+// otherwise schedules a load and returns 0 (-1 if loading failed for good).
+static int asset_acquire(Asset *a, int frame){
+    a->last_used_ms=now_monotonic_ms(); a->used_frame=frame;
+    pthread_mutex_lock(&g_am.mu);
+    AssetState st=a->state;
+    if(st==AS_UNLOADED||st==AS_EVICTED){
+        if(st==AS_UNLOADED && !a->peek_w) png_peek_size(a->path,&a->peek_w,&a->peek_h);
+        a->state=AS_QUEUED; asset_enqueue_locked(a);
+    } else if(st==AS_EVICTING) a->want=1;
+    uint8_t *old = (st==AS_READY)? a->preview : NULL;
+    if(old) a->preview=NULL;
+    pthread_mutex_unlock(&g_am.mu);
+    free(old);
+    return st==AS_READY? 1 : (st==AS_FAILED? -1 : 0);
+}
+// First frame of an animation still loading (NULL if not decoded yet).
+static const uint8_t* asset_preview(Asset *a, int *w, int *h){
+    pthread_mutex_lock(&g_am.mu);
+    const uint8_t *p=a->preview; *w=a->preview_w; *h=a->preview_h;
+    pthread_mutex_unlock(&g_am.mu);
+    return p;
+}
+// Pixels of frame idx (0 for static images) of a READY asset, premultiplied
+// and canvas-sized; valid until the next call. NULL if it can't be produced.
+static const uint8_t* asset_frame(Asset *a, unsigned idx){
+    if(a->store==STORE_RAW) return a->is_anim? a->anim.frame_rgba[idx] : a->stat.rgba;
+    if(a->store==STORE_RLE){
+        if(g_am.scratch_owner==a && g_am.scratch_idx==idx) return g_am.scratch;
+        size_t n=asset_frame_px(a);
+        if(g_am.scratch_cap<n*4){ free(g_am.scratch); g_am.scratch=(uint8_t*)malloc(n*4); if(!g_am.scratch) die("malloc scratch"); g_am.scratch_cap=n*4; }
+        g_am.scratch_owner=NULL;
+        if(idx>=a->rle.n || rle_decode(a->rle.frame[idx],a->rle.len[idx],g_am.scratch,n)!=0) return NULL;
+        g_am.scratch_owner=a; g_am.scratch_idx=idx; return g_am.scratch;
+    }
+    // stream: compose forward from the current position, rewinding on loop
+    if(!a->stream) return NULL;
+    if(idx==a->stream_idx) return a->stream_frame;
+    if(idx<a->stream_idx){ apng_dec_rewind(a->stream); a->stream_idx=(unsigned)-1; }
+    while(a->stream_idx!=idx){
+        unsigned ms; if(apng_dec_next(a->stream,&a->stream_frame,&ms)!=1){ a->stream_frame=NULL; return NULL; }
+        a->stream_idx = a->stream->frames_out-1;
+    }
+    return a->stream_frame;
+}
+// Blocks until the loader has nothing left to do (single-shot mode).
+static void asset_wait_idle(void){
+    pthread_mutex_lock(&g_am.mu);
+    while(g_am.busy||g_am.qn) pthread_cond_wait(&g_am.idle_cv,&g_am.mu);
+    pthread_mutex_unlock(&g_am.mu);
+}
+// Called once per frame after drawing: evict least recently drawn assets (never
+// ones drawn this frame) until resident + cached fits the budget.
+static void asset_enforce_budget(int frame){
+    if(!g_am.budget) return;
+    pthread_mutex_lock(&g_am.mu);
+    size_t pending=0; // bytes already on their way out
+    for(int i=0;i<g_am.n_all;i++) if(g_am.all[i]->state==AS_EVICTING) pending+=g_am.all[i]->bytes;
+    while(g_am.resident + g_am.cached - pending > g_am.budget){
+        Asset *victim=NULL;
+        for(int i=0;i<g_am.n_all;i++){ Asset *a=g_am.all[i];
+            if(a->state!=AS_READY || a->pinned || a->used_frame==frame) continue;
+            if(!victim || a->last_used_ms<victim->last_used_ms) victim=a; }
+        if(victim){
+            if(g_am.scratch_owner==victim) g_am.scratch_owner=NULL;
+            victim->state=AS_EVICTING; victim->want=0; pending+=victim->bytes; asset_enqueue_locked(victim); continue;
+        }
+        // still over: drop RLE copies of raw assets, redundant ones (asset
+        // resident) first, then the oldest; those assets reload from disk
+        for(int i=0;i<g_am.n_all;i++){ Asset *a=g_am.all[i];
+            if((a->state!=AS_EVICTED && a->state!=AS_READY) || a->store!=STORE_RAW || !a->rle.n) continue;
+            int better = !victim || (a->state==AS_READY && victim->state!=AS_READY) ||
+                         (a->state==victim->state && a->last_used_ms<victim->last_used_ms);
+            if(better) victim=a; }
+        if(!victim) break; // everything left is in use this frame
+        g_am.cached-=victim->rle.bytes; rle_free(&victim->rle);
+        if(victim->state==AS_EVICTED) victim->state=AS_UNLOADED;
+    }
+    pthread_mutex_unlock(&g_am.mu);
+}
+// Drops an asset no layer uses any more; the loader must be idle.
+static void asset_release(Asset *a){
+    pthread_mutex_lock(&g_am.mu);
+    if(a->state==AS_READY) g_am.resident-=a->bytes;
+    if(a->store==STORE_RAW && a->rle.n) g_am.cached-=a->rle.bytes;
+    if(g_am.scratch_owner==a) g_am.scratch_owner=NULL;
+    for(int i=0;i<g_am.n_all;i++) if(g_am.all[i]==a){ memmove(g_am.all+i,g_am.all+i+1,(size_t)(g_am.n_all-i-1)*sizeof(Asset*)); g_am.n_all--; break; }
+    pthread_mutex_unlock(&g_am.mu);
+    asset_free(a); free(a);
+}
+
+static size_t fill_rect_fb(uint8_t *fb,int fbw,int fbh,int x,int y,int w,int h,uint8_t r,uint8_t g,uint8_t b,uint8_t a){
+    if(a==0) return 0;
+    uint8_t p[4]={ (uint8_t)((r*a+127)/255), (uint8_t)((g*a+127)/255), (uint8_t)((b*a+127)/255), a };
+    int x0=x<0?0:x, y0=y<0?0:y, x1=x+w>fbw?fbw:x+w, y1=y+h>fbh?fbh:y+h;
+    for(int yy=y0;yy<y1;yy++) for(int xx=x0;xx<x1;xx++) over_premul(fb+4*((size_t)yy*fbw+xx),p);
+    return (x1>x0 && y1>y0)? (size_t)(x1-x0)*(size_t)(y1-y0) : 0;
+}
+
+// Shapes -------------------------------------------------------------------------
+// Overlays with a shape, rounded corners, a border or a gradient are rendered
+// once (at load and on reload) in layout coordinates with antialiased edges,
+// turned into FB orientation and drawn with the image blitter; plain
+// rectangles keep the fill kernels.
+static int ov_is_shape(const Overlay *ov){ return ov->shape || ov->radius>0 || ov->border>0 || ov->gradient; }
+// Signed distance from p (relative to the centre) to the shape's edge, px
+static double shape_dist(int ellipse, double px, double py, double hw, double hh, double rad){
+    if(hw<=0 || hh<=0) return 1.0;
+    if(ellipse){ // approximation, exact on the axes
+        double k0=sqrt(px*px/(hw*hw)+py*py/(hh*hh)), k1=sqrt(px*px/(hw*hw*hw*hw)+py*py/(hh*hh*hh*hh));
+        return k1>0? k0*(k0-1.0)/k1 : -(hw<hh?hw:hh);
+    }
+    if(rad>hw) rad=hw; if(rad>hh) rad=hh;
+    double qx=fabs(px)-hw+rad, qy=fabs(py)-hh+rad;
+    double ox=qx>0?qx:0, oy=qy>0?qy:0, in=qx>qy?qx:qy;
+    return sqrt(ox*ox+oy*oy)+(in<0?in:0)-rad;
+}
+// Premultiplied sprite of ov in FB orientation and its FB position. Layout
+// pixels outside lw x lh are left transparent, like the rect clip.
+static uint8_t* shape_render(const Overlay *ov, const UiXform *t, int lw, int lh, int *fx, int *fy, int *fw, int *fh){
+    int w=ov->w, h=ov->h; if(w<=0 || h<=0) return NULL;
+    const UiKernels *k=t->k;
+    double hw=w/2.0, hh=h/2.0, bw=ov->border, rad=ov->radius, a=ov->angle*M_PI/180.0, dx=cos(a), dy=sin(a);
+    double lo=(dx<0?dx*w:0)+(dy<0?dy*h:0), span=fabs(dx)*w+fabs(dy)*h; // linear: projection range over the rect
+    int x0=t->bx+k->ax*ov->x+k->ay*ov->y, y0=t->by+k->cx*ov->x+k->cy*ov->y;
+    int x1=t->bx+k->ax*(ov->x+w-1)+k->ay*(ov->y+h-1), y1=t->by+k->cx*(ov->x+w-1)+k->cy*(ov->y+h-1);
+    *fx=x0<x1?x0:x1; *fy=y0<y1?y0:y1; *fw=abs(k->ax)*w+abs(k->ay)*h; *fh=abs(k->cx)*w+abs(k->cy)*h;
+    uint8_t *out=(uint8_t*)calloc((size_t)w*h,4); if(!out) die("calloc shape");
+    for(int j=0;j<h;j++){
+        int yl=ov->y+j; if(yl<0 || yl>=lh) continue;
+        for(int i=0;i<w;i++){
+            int xl=ov->x+i; if(xl<0 || xl>=lw) continue;
+            double px=i+0.5-hw, py=j+0.5-hh, d=shape_dist(ov->shape,px,py,hw,hh,rad);
+            double cov=0.5-d; if(cov<=0) continue; if(cov>1) cov=1;
+            double cin=cov;
+            if(bw>0){ cin=0.5-shape_dist(ov->shape,px,py,hw-bw,hh-bw,rad>bw?rad-bw:0); if(cin<0) cin=0; if(cin>cov) cin=cov; }
+            double f[4]={ ov->r, ov->g, ov->b, ov->a };
+            if(ov->gradient){
+                double tt = ov->gradient==1? (span>0? ((i+0.5)*dx+(j+0.5)*dy-lo)/span : 0) : sqrt(px*px/(hw*hw)+py*py/(hh*hh));
+                if(tt<0) tt=0; if(tt>1) tt=1;
+                const uint8_t c2[4]={ ov->r2, ov->g2, ov->b2, ov->a2 };
+                for(int c=0;c<4;c++) f[c]+= (c2[c]-f[c])*tt;
+            }
+            const double bc[4]={ ov->br, ov->bg, ov->bb, ov->ba };
+            double fa=f[3]/255.0*cin, ba=bc[3]/255.0*(cov-cin), A=fa+ba;
+            int fxp=t->bx+k->ax*xl+k->ay*yl-*fx, fyp=t->by+k->cx*xl+k->cy*yl-*fy;
+            uint8_t *o=out+4*((size_t)fyp*(*fw)+fxp);
+            for(int c=0;c<3;c++){ double v=f[c]*fa+bc[c]*ba; o[c]=(uint8_t)(v>255?255:v+0.5); }
+            o[3]=(uint8_t)(A>=1?255:A*255+0.5);
+        }
+    }
+    return out;
+}
+
+// Display list -------------------------------------------------------------------
+// The Layout is compiled into a flat list of draw ops with everything that is
+// the same from frame to frame resolved up front: asset pointers (layers with
+// the same file and settings share one), fonts, the UI mapping of each text and
+// the FB-clipped job of each overlay (overlays left with nothing to draw are
+// dropped). Each frame is resolved first (what every op shows: visibility,
+// asset state, APNG frame, expanded text), hashed into a key, and then drawn;
+// when the key matches the last complete frame nothing is drawn and the
+// previous frame goes out again. On SIGHUP
+// the new layout is compiled against the old list: matching assets move over
+// with their decoded frames, and the two lists are diffed for the log.
+typedef enum { OP_BG=0, OP_IMG, OP_RECT, OP_TEXT } DrawOpKind;
+typedef struct {
+    DrawOpKind kind; int layer;         // index in Layout.imgs/overlays/texts
+    int page; const char *visible_if;   // the Layout's (not copied)
+    // OP_BG / OP_IMG: FB position (OP_BG: resolved for pw x ph from lx/ly)
+    Asset *asset; int x, y, alpha; float scale;
+    BlitMaps bm;                        // scale != 1: source maps for the current frame size (owned)
+    int lx, ly, center_x, center_y, pw, ph;
+    uint8_t hold[4];                    // OP_IMG placeholder colour while loading
+    unsigned shown_idx; int shown_frame; // APNG frame drawn last, and in which frame (pacing stats)
+    const char *frame_from; double frame_min, frame_max; // OP_IMG sprite: frame picked by value (Layout's)
+    const char *rotate_from; RotSpec rot; RotCache rc; int rot_q; // OP_IMG rotation (rot_q: angle in steps)
+    // OP_RECT: clipped job (fb set when drawn), or a shape's sprite at x,y (owned); OP_TEXT: mapping
+    UiJob job; UiFn fn; UiXform xf;
+    uint8_t *spr; int spr_w, spr_h, spr_opaque;
+    // OP_TEXT
+    const TextItem *ti; TtfCache *font; int tokens;
+    Marquee mq; int scroll_w, scrolling; // scroll=: window width, and whether the text overflows it this frame
+    TextBox tb; int boxed;              // width=/height=/max_lines=: line breaks of the current text
+    // Layer clock (update_hz): resolved again once next_ms is reached on the playback clock
+    uint64_t update_ms, next_ms, res_ms; int res_page; // res_*: when and on which page last resolved
+    // Set by dl_resolve for the frame being built (or kept from the last resolve)
+    int vis, ready;                     // ready: asset_acquire() result
+    uint64_t key;                       // share of DisplayList.key
+    unsigned idx;                       // APNG frame (kept while a sprite's value is unavailable)
+    char *text;                         // OP_TEXT with tokens: expanded text (owned)
+} DrawOp;
+typedef struct {
+    DrawOp *op; int n, cap;
+    Asset **assets; int n_assets;       // owned; [0] is the background PNG, if any
+    uint8_t *fill_row, *fill_col;       // background_color/_gradient: one FB row, or one colour per row (owned)
+    uint64_t key;                       // dl_resolve: hash of what the frame shows
+} DisplayList;
+
+static DrawOp* dl_push(DisplayList *D, DrawOpKind kind, int page, const char *visible_if){
+    if(D->n==D->cap){ D->cap=D->cap?D->cap*2:16; D->op=(DrawOp*)realloc(D->op,D->cap*sizeof(DrawOp)); if(!D->op) die("realloc ops"); }
+    DrawOp *o=&D->op[D->n++]; memset(o,0,sizeof *o);
+    o->shown_frame=-2; o->res_page=-2; o->kind=kind; o->page=page; o->visible_if=visible_if; return o;
+}
+static void dl_add_asset(DisplayList *D, Asset *a){
+    D->assets=(Asset**)realloc(D->assets,(D->n_assets+1)*sizeof(Asset*)); if(!D->assets) die("realloc dl assets");
+    D->assets[D->n_assets++]=a;
+}
+// Same file and settings: one already in D, else one taken over from prev, else a new one
+static Asset* dl_asset(DisplayList *D, DisplayList *prev, const char *path, int rotate180, int pinned, int storage,
+                       double speed, int64_t start_ms, int loop_mode, int loop_N, int resample, double resample_ms){
+    for(int pass=0;pass<2;pass++){
+        DisplayList *S = pass? prev : D; if(!S) continue;
+        for(int i=0;i<S->n_assets;i++){ Asset *a=S->assets[i];
+            if(!a || strcmp(a->path,path) || a->rotate180!=rotate180 || a->pinned!=pinned || (int)a->want_store!=storage ||
+               a->speed!=speed || a->start_ms!=start_ms || a->loop_mode!=loop_mode || a->loop_N!=loop_N ||
+               a->resample!=resample || a->resample_ms!=resample_ms) continue;
+            if(pass){ S->assets[i]=NULL; dl_add_asset(D,a); }
+            return a;
+        }
+    }
+    Asset *a=(Asset*)calloc(1,sizeof *a); if(!a) die("calloc asset");
+    asset_init(a,path,rotate180,storage,speed,start_ms,loop_mode,loop_N); a->pinned=pinned;
+    a->resample=resample; a->resample_ms=resample_ms;
+    dl_add_asset(D,a); return a;
+}
+static uint64_t hz_ms(double hz){ return hz>0? (uint64_t)llround(1000.0/hz) : 0; } // update_hz -> layer clock period
+static void dl_build(DisplayList *D, const Layout *L, int fbw, int fbh, DisplayList *prev){
+    memset(D,0,sizeof *D);
+    if(L->bg_fill){ // gradients run across the viewport, flat outside it
+        int vx,vy; compute_viewport(L,&vx,&vy);
+        int n = L->bg_fill==2? fbh : fbw, v0 = L->bg_fill==2? vy : vx, span = (L->bg_fill==2? H : W)-1;
+        uint8_t *p=(uint8_t*)malloc((size_t)n*4); if(!p) die("malloc background fill");
+        for(int i=0;i<n;i++){
+            double t = L->bg_fill==1 || span<=0? 0 : (double)(i-v0)/span; if(t<0) t=0; if(t>1) t=1;
+            for(int c=0;c<3;c++) p[4*i+c]=(uint8_t)(L->bg_c0[c]+(L->bg_c1[c]-L->bg_c0[c])*t+0.5);
+            p[4*i+3]=255;
+        }
+        if(L->bg_fill==2) D->fill_col=p; else D->fill_row=p;
+    }
+    DrawOp *o;
+    if(L->background_png[0]){ // background frames are rotated once at load if background_flip
+        o=dl_push(D,OP_BG,-1,NULL);
+        int rs = L->fps>0? L->apng_resample : 0;
+        o->asset=dl_asset(D,prev,L->background_png,L->background_flip,1,L->bg_storage,L->bg_apng_speed,L->bg_apng_start_ms,L->bg_apng_loop_mode,L->bg_apng_loop_N,
+                          rs, rs? 1000.0*L->bg_apng_speed/L->fps : 0);
+        o->lx=L->bg_x; o->ly=L->bg_y; o->center_x=L->bg_x_mode; o->center_y=L->bg_y_mode; o->pw=o->ph=-1;
+        o->alpha=-1; o->scale=1.0f; o->update_ms=hz_ms(L->bg_update_hz);
+    }
+
+    for(int i=0;i<L->n_imgs;i++){
+        const ImgLayer *im=&L->imgs[i];
+        o=dl_push(D,OP_IMG,im->page,im->visible_if); o->layer=i; o->update_ms=hz_ms(im->update_hz);
+        // sprites index frames by value: never resampled
+        int rs = L->fps>0 && !im->frame_from? (im->apng_resample>=0? im->apng_resample : L->apng_resample) : 0;
+        o->asset=dl_asset(D,prev,im->path,0,0,im->storage,im->apng_speed,im->apng_start_ms,im->apng_loop_mode,im->apng_loop_N,
+                          rs, rs? 1000.0*im->apng_speed/L->fps : 0);
+        o->x=im->x; o->y=im->y; o->alpha=im->alpha; o->scale=im->scale>0?im->scale:1.0f;
+        o->hold[0]=L->placeholder_r; o->hold[1]=L->placeholder_g; o->hold[2]=L->placeholder_b; o->hold[3]=L->placeholder_a;
+        o->frame_from=im->frame_from; o->frame_min=im->frame_min; o->frame_max=im->frame_max;
+        o->rotate_from=im->rotate_from; o->rot=im->rot; o->rot_q=(int)lround(im->rot.a0/im->rot.step);
+    }
+
+    UiXform t; ui_xform(&t,L->text_orient,L->text_flip,L->text_landscape_ccw,fbw,fbh,L);
+    int LW=(L->text_orient==ORIENT_PORTRAIT)?W:H, LH=(L->text_orient==ORIENT_PORTRAIT)?H:W;
+    for(int i=0;i<L->n_overlays;i++){
+        const Overlay *ov=&L->overlays[i];
+        int x0=ov->x<0?0:ov->x, y0=ov->y<0?0:ov->y, x1=ov->x+ov->w, y1=ov->y+ov->h;
+        if(x1>LW)x1=LW; if(y1>LH)y1=LH;
+        UiJob j; if((ov->a==0 && !ov_is_shape(ov)) || !ui_clip(&t,&j,NULL,fbw,x0,y0,x1,y1)) continue;
+        if(ov_is_shape(ov)){
+            o=dl_push(D,OP_RECT,ov->page,ov->visible_if); o->layer=i; o->update_ms=hz_ms(ov->update_hz);
+            o->spr=shape_render(ov,&t,LW,LH,&o->x,&o->y,&o->spr_w,&o->spr_h);
+            if(o->spr) o->spr_opaque=rgba_opaque(o->spr,(size_t)o->spr_w*o->spr_h);
+            continue;
+        }
+        j.px[0]=mul255(ov->r,ov->a); j.px[1]=mul255(ov->g,ov->a); j.px[2]=mul255(ov->b,ov->a); j.px[3]=ov->a;
+        o=dl_push(D,OP_RECT,ov->page,ov->visible_if); o->layer=i; o->update_ms=hz_ms(ov->update_hz);
+        o->job=j; o->fn = ov->a==255? t.k->store : t.k->fill;
+    }
+
+    for(int i=0;i<L->n_texts;i++){
+        const TextItem *ti=&L->texts[i];
+        const char *path = ti->ttf_path ? ti->ttf_path : (L->default_ttf[0]? L->default_ttf : NULL);
+        int px = ti->ttf_px>0 ? ti->ttf_px : (L->default_ttf_px>0 ? L->default_ttf_px : 0);
+        if(!path||(px<=0 && !font_is_bdf(path))){ fprintf(stderr,"[text] missing TTF/size; skipping \"%s\"\n", ti->text?ti->text:""); continue; }
+        TtfCache *fc=ttf_get(path,px); if(!fc) continue;
+        UiOrient orient=L->text_orient; int flip=L->text_flip, ccw=L->text_landscape_ccw;
+        if(ti->orient_override!=-1) orient=(ti->orient_override==1)?ORIENT_LANDSCAPE:ORIENT_PORTRAIT;
+        if(ti->flip_override!=-1) flip=ti->flip_override;
+        if(ti->landscape_ccw_override!=-1) ccw=ti->landscape_ccw_override;
+        o=dl_push(D,OP_TEXT,ti->page,ti->visible_if); o->layer=i; o->update_ms=hz_ms(ti->update_hz);
+        ui_xform(&o->xf,orient,flip,ccw,fbw,fbh,L);
+        o->ti=ti; o->font=fc; o->tokens = ti->text && strchr(ti->text,'%');
+        o->scroll_w = ti->scroll_w>0? ti->scroll_w : ti->box_w>0? ti->box_w : (orient==ORIENT_PORTRAIT? W : H)-ti->x;
+        o->boxed = ti->box_w>0 || ti->box_h>0 || ti->max_lines>0;
+        if(o->scroll_w<1) o->scroll_w=1;
+    }
+}
+// Releases the assets still owned (those not taken over by a newer list)
+static void dl_free(DisplayList *D){
+    for(int i=0;i<D->n_assets;i++) if(D->assets[i]) asset_release(D->assets[i]);
+    for(int i=0;i<D->n;i++){ free(D->op[i].text); rot_free(&D->op[i].rc); mq_free(&D->op[i].mq); tb_free(&D->op[i].tb); free(D->op[i].spr); blit_maps_free(&D->op[i].bm); }
+    free(D->assets); free(D->op); free(D->fill_row); free(D->fill_col); memset(D,0,sizeof *D);
+}
+// Clears fb to the background fill (black without one). Every row is a copy
+// of the cached row, or one colour doubled out with memcpy, so a gradient
+// costs about what the memset does.
+static void dl_clear(const DisplayList *D, uint8_t *fb, int fbw, int fbh){
+    size_t row=(size_t)fbw*4;
+    if(D->fill_row){ for(int y=0;y<fbh;y++) memcpy(fb+row*y,D->fill_row,row); }
+    else if(D->fill_col){
+        for(int y=0;y<fbh;y++){
+            uint8_t *d=fb+row*y; memcpy(d,D->fill_col+4*(size_t)y,4);
+            for(size_t n=4;n<row;n*=2) memcpy(d+n,d,n*2<=row? n : row-n);
+        }
+    }
+    else memset(fb,0,row*fbh);
+}
+// Background placement for a w x h frame; redone only when the size changes
+// (first-frame preview vs. full canvas)
+static void dl_place_bg(DrawOp *o, int w, int h, int fbw, int fbh){
+    if(o->pw==w && o->ph==h) return;
+    o->pw=w; o->ph=h;
+    o->x = o->center_x? (fbw-w)/2 : o->lx;
+    o->y = o->center_y? (fbh-h)/2 : o->ly;
+    if(o->x<-w) o->x=-w; if(o->y<-h) o->y=-h; if(o->x>fbw) o->x=fbw; if(o->y>fbh) o->y=fbh;
+}
+// Pacing: when an animated layer moves to a new APNG frame, remember when that
+// frame was due (the earliest over all layers ends up in g_apng_due_us and goes
+// to the transmit thread with the frame) and count the frames skipped over.
+// Only frames that follow one another count, so hidden layers and the first
+// draw don't.
+static uint64_t g_apng_due_us; // render thread
+static void dl_note_apng(DrawOp *o, const ApngAnim *A, unsigned idx, unsigned rem_ms, double speed, uint64_t now_ms, int frame){
+    if(o->shown_frame==frame-1 && idx!=o->shown_idx && A->num_frames){
+        unsigned n=A->num_frames, in_frame=A->delay_ms[idx]>rem_ms? A->delay_ms[idx]-rem_ms : 0;
+        uint64_t due=now_ms*1000 - (uint64_t)(in_frame*1000.0/(speed>0?speed:1.0));
+        if(!g_apng_due_us || due<g_apng_due_us) g_apng_due_us=due;
+        g_stats.apng_dropped += (idx+n-o->shown_idx-1)%n;
+    }
+    o->shown_idx=idx; o->shown_frame=frame;
+}
+// Sprite layers (frame_from) map the value linearly from frame_min..frame_max
+// onto the first..last frame; while it is unavailable the last frame stays.
+static unsigned dl_sprite_frame(const DrawOp *o, unsigned n, const Metrics *M){
+    double v=cond_value(o->frame_from,M);
+    if(isnan(v) || n<2) return o->idx<n? o->idx : 0;
+    double t=(v-o->frame_min)/(o->frame_max-o->frame_min);
+    if(!(t>0)) t=0; if(t>1) t=1;
+    return (unsigned)(t*(n-1)+0.5);
+}
+// Angle of a rotated layer in rotate_step units; kept while the value is unavailable
+static int dl_rot_steps(const DrawOp *o, const Metrics *M){
+    double v=cond_value(o->rotate_from,M);
+    if(isnan(v)) return o->rot_q;
+    double t=(v-o->rot.v0)/(o->rot.v1-o->rot.v0);
+    if(!(t>0)) t=0; if(t>1) t=1;
+    return (int)lround((o->rot.a0+t*(o->rot.a1-o->rot.a0))/o->rot.step);
+}
+static uint64_t key_mix(uint64_t h, uint64_t v){ h^=v; h*=1099511628211ull; return h^(h>>29); }
+// Decides what one op shows this frame and returns its share of the frame key.
+// *waiting is set to 1 while its asset loads, -1 if the background failed.
+static uint64_t dl_resolve_op(DrawOp *o, int page, const Metrics *M, int frame, uint64_t t0, int *waiting){
+    o->vis=layer_visible(o->page, o->visible_if, page, M);
+    uint64_t k=key_mix(1469598103934665603ull,(uint64_t)o->vis);
+    if(!o->vis || o->kind==OP_RECT) return k;
+    if(o->kind==OP_TEXT){
+        const char *txt=o->ti->text? o->ti->text : "";
+        if(o->tokens){
+            if(!o->text && !(o->text=(char*)malloc(1024))) die("malloc text");
+            expand_tokens(o->text,1024,o->ti->text,M); k=key_mix(k,fnv1a64((const uint8_t*)o->text,strlen(o->text)));
+            txt=o->text;
+        }
+        if(o->ti->scroll>0){
+            if(!o->mq.text || strcmp(o->mq.text,txt)) mq_render(&o->mq,o->font,txt,o->ti->scroll_gap);
+            o->scrolling = o->mq.adv > o->scroll_w;
+            if(o->scrolling){
+                double px=fmod((now_monotonic_ms()-t0)/1000.0*o->ti->scroll, o->mq.w);
+                o->mq.pos=(uint32_t)(px*256); k=key_mix(k,o->mq.pos);
+            }
+        }
+        if(o->boxed && !o->scrolling && (!o->tb.text || strcmp(o->tb.text,txt))){
+            const TextItem *ti=o->ti; int lines=ti->max_lines;
+            if(ti->box_h>0){ int fit=ti->box_h/(o->font->line_px>0? o->font->line_px : 1); if(fit<1) fit=1; if(lines<=0 || fit<lines) lines=fit; }
+            tb_layout(&o->tb,o->font,txt,ti->box_w,lines, ti->ellipsis? ti->ellipsis : font_has(o->font,0x2026)? "\xe2\x80\xa6" : "...");
+        }
+        return k;
+    }
+    Asset *a=o->asset;
+    o->ready=asset_acquire(a,frame);
+    k=key_mix(k,(uint64_t)(o->ready+1));
+    if(o->ready<0){ if(o->kind==OP_BG) *waiting=-1; return k; }
+    if(o->ready==0){ *waiting=1; return k; }
+    if(!a->is_anim) o->idx=0;
+    else if(o->frame_from) o->idx=dl_sprite_frame(o,a->anim.num_frames,M);
+    else {
+        uint64_t now=now_monotonic_ms(), elapsed = now - t0 + (uint64_t)(a->start_ms>=0? a->start_ms : 0);
+        unsigned rem_ms=0;
+        o->idx=apng_pick_frame(&a->anim, elapsed, a->speed, a->loop_mode, a->loop_N, &rem_ms);
+        dl_note_apng(o,&a->anim,o->idx,rem_ms,a->speed,now,frame);
+    }
+    k=key_mix(k,o->idx);
+    if(o->rotate_from){ o->rot_q=dl_rot_steps(o,M); k=key_mix(k,(uint64_t)(int64_t)o->rot_q); }
+    return k;
+}
+// Decides what every op shows this frame and sets D->key from it. An op with
+// update_hz is only resolved again when its clock fires (on the playback clock,
+// so --analyze sees the same cadence), on a page switch, or when its asset's
+// load state changes; until then it keeps its text, frame and visibility, and
+// its tokens, conditions and text layout are not evaluated. g_apng_due_us is
+// cleared first; see dl_note_apng. Returns how many visible assets are still
+// loading, or -1 if the background failed to load.
+static int dl_resolve(DisplayList *D, int page, const Metrics *M, int frame, uint64_t t0){
+    int waiting=0; uint64_t k=key_mix(1469598103934665603ull,(uint64_t)(page+1)), clk=now_monotonic_ms()-t0;
+    g_apng_due_us=0;
+    for(int i=0;i<D->n;i++){
+        DrawOp *o=&D->op[i];
+        int img = o->kind==OP_BG || o->kind==OP_IMG;
+        int due = !o->update_ms || o->res_page!=page || clk>=o->next_ms || clk<o->res_ms;
+        if(!due && o->vis && img) due = asset_acquire(o->asset,frame)!=o->ready; // keeps it in use; loaded/failed shows at once
+        if(due){
+            int w=0; o->key=dl_resolve_op(o,page,M,frame,t0,&w);
+            if(w<0) return -1;
+            waiting+=w; o->res_page=page; o->res_ms=clk;
+            if(o->update_ms) o->next_ms = clk>=o->next_ms && clk-o->next_ms<o->update_ms? o->next_ms+o->update_ms : clk+o->update_ms;
+        } else if(o->vis && img && o->ready==0) waiting++;
+        k=key_mix(k,o->key);
+    }
+    D->key=k;
+    return waiting;
+}
+static void dl_run_rotated(DrawOp *o, uint8_t *fb, int fbw, int fbh, int w, int h, OpStats *st){
+    int n=(int)lround(360.0/o->rot.step), q=((o->rot_q%n)+n)%n, key=(int)o->idx*4096+q;
+    double pvx=isnan(o->rot.pvx)? w/2.0 : o->rot.pvx, pvy=isnan(o->rot.pvy)? h/2.0 : o->rot.pvy;
+    double fx=o->x+pvx*o->scale, fy=o->y+pvy*o->scale; int ix=(int)floor(fx), iy=(int)floor(fy);
+    RotEntry *e=rot_find(&o->rc,key);
+    if(!e){
+        const uint8_t *px=asset_frame(o->asset,o->idx); if(!px) return;
+        e=rot_slot(&o->rc,o->rot.cache); e->key=key;
+        rot_render(e,px,w,h,q*o->rot.step,o->scale,pvx,pvy,fx-ix,fy-iy);
+        o->rc.bytes+=(size_t)e->w*e->h*4;
+    }
+    size_t np=blit_png_into_fb(fb,fbw,fbh, e->px, e->w,e->h, ix+e->ox,iy+e->oy, o->alpha, 1.0f, 0, NULL);
+    if(st) st->px+=np;
+}
+static void dl_run_op(DrawOp *o, uint8_t *fb, int fbw, int fbh, OpStats *st){
+    if(o->kind==OP_RECT && o->spr){
+        size_t np=blit_png_into_fb(fb,fbw,fbh, o->spr,o->spr_w,o->spr_h, o->x,o->y, -1, 1.0f, o->spr_opaque, NULL);
+        if(st) st->px+=np;
+        return;
+    }
+    if(o->kind==OP_RECT){
+        o->job.fb=fb; o->fn(&o->job);
+        if(st) st->px+=(uint64_t)(o->job.x1-o->job.x0)*(o->job.y1-o->job.y0);
+        return;
+    }
+    if(o->kind==OP_TEXT){
+        const TextItem *ti=o->ti; const char *s=o->tokens? o->text : ti->text?ti->text:"";
+        if(o->scrolling) mq_draw(&o->mq,fb,fbw,&o->xf,ti->x,ti->y,o->scroll_w,ti->r,ti->g,ti->b,ti->a,st);
+        else if(o->boxed) tb_draw(&o->tb,fb,fbw,&o->xf,o->font,ti,st);
+        else draw_text_run(fb,fbw,&o->xf,o->font,s,ti->x,ti->y,ti->r,ti->g,ti->b,ti->a,st);
+        return;
+    }
+    Asset *a=o->asset; const uint8_t *px; int w,h,opaque=0; size_t n;
+    if(o->ready==0){
+        if(o->rotate_from || !(px=asset_preview(a,&w,&h))){ // first APNG frame while the rest decodes, else a placeholder
+            if(o->kind==OP_IMG){
+                n=fill_rect_fb(fb,fbw,fbh, o->x,o->y, (int)(a->peek_w*o->scale),(int)(a->peek_h*o->scale), o->hold[0],o->hold[1],o->hold[2],o->hold[3]);
+                if(st) st->px+=n;
+            }
+            return;
+        }
+    } else {
+        if(a->is_anim){ w=(int)a->anim.canvas_w; h=(int)a->anim.canvas_h; }
+        else { w=a->stat.w; h=a->stat.h; }
+        if(o->rotate_from && o->kind==OP_IMG){ dl_run_rotated(o,fb,fbw,fbh,w,h,st); return; }
+        if(!(px=asset_frame(a,o->idx))) return;
+        opaque=a->opaque;
+    }
+    if(o->kind==OP_BG) dl_place_bg(o,w,h,fbw,fbh);
+    n=blit_png_into_fb(fb,fbw,fbh, px, w,h, o->x,o->y, o->alpha, o->scale, opaque, &o->bm);
+    if(st) st->px+=n;
+}
+// Draws what dl_resolve decided. st (one per op, or NULL) collects pixels,
+// glyphs and time per op.
+static void dl_draw(DisplayList *D, uint8_t *fb, int fbw, int fbh, OpStats *st){
+    for(int i=0;i<D->n;i++){
+        DrawOp *o=&D->op[i];
+        if(!o->vis || ((o->kind==OP_BG || o->kind==OP_IMG) && o->ready<0)) continue;
+        uint64_t t = (st||TRACE_ON())? now_monotonic_us() : 0;
+        PROBE2(layer_begin, i, o->kind);
+        dl_run_op(o,fb,fbw,fbh,st?&st[i]:NULL);
+        PROBE2(layer_end, i, o->kind);
+        if(st){ st[i].us+=now_monotonic_us()-t; st[i].frames++; }
+        if(t){ static const char *const kn[]={ "background", "image", "overlay", "text" };
+               trace_span(TID_RENDER, "layer", kn[o->kind], t, i, o->asset? o->asset->path : o->ti? o->ti->text : NULL); }
+    }
+}
+static int dl_op_same(const DrawOp *a, const DrawOp *b){
+    if(a->kind!=b->kind || a->page!=b->page || a->update_ms!=b->update_ms) return 0;
+    if((a->visible_if==NULL)!=(b->visible_if==NULL) || (a->visible_if && strcmp(a->visible_if,b->visible_if))) return 0;
+    switch(a->kind){
+    case OP_BG:   return a->asset==b->asset && a->lx==b->lx && a->ly==b->ly && a->center_x==b->center_x && a->center_y==b->center_y;
+    case OP_IMG:  return a->asset==b->asset && a->x==b->x && a->y==b->y && a->alpha==b->alpha && a->scale==b->scale && !memcmp(a->hold,b->hold,4) &&
+                         !strcmp(a->frame_from?a->frame_from:"",b->frame_from?b->frame_from:"") && a->frame_min==b->frame_min && a->frame_max==b->frame_max &&
+                         !strcmp(a->rotate_from?a->rotate_from:"",b->rotate_from?b->rotate_from:"") && rot_same(&a->rot,&b->rot);
+    case OP_RECT: if(a->spr || b->spr) return a->spr && b->spr && a->x==b->x && a->y==b->y && a->spr_w==b->spr_w && a->spr_h==b->spr_h &&
+                                                !memcmp(a->spr,b->spr,(size_t)a->spr_w*a->spr_h*4);
+                  return a->fn==b->fn && a->job.bx==b->job.bx && a->job.by==b->job.by && a->job.x0==b->job.x0 && a->job.y0==b->job.y0 &&
+                         a->job.x1==b->job.x1 && a->job.y1==b->job.y1 && !memcmp(a->job.px,b->job.px,4);
+    case OP_TEXT: return a->font==b->font && a->xf.k==b->xf.k && a->xf.bx==b->xf.bx && a->xf.by==b->xf.by &&
+                         a->ti->x==b->ti->x && a->ti->y==b->ti->y && a->ti->r==b->ti->r && a->ti->g==b->ti->g &&
+                         a->ti->b==b->ti->b && a->ti->a==b->ti->a && a->ti->scroll==b->ti->scroll && a->scroll_w==b->scroll_w &&
+                         a->ti->scroll_gap==b->ti->scroll_gap && a->ti->box_w==b->ti->box_w && a->ti->box_h==b->ti->box_h &&
+                         a->ti->max_lines==b->ti->max_lines && a->ti->align==b->ti->align &&
+                         !strcmp(a->ti->ellipsis?a->ti->ellipsis:"",b->ti->ellipsis?b->ti->ellipsis:"") && !strcmp(a->ti->text?a->ti->text:"",b->ti->text?b->ti->text:"");
+    }
+    return 0;
+}
+// Logs what a reload changed: identical ops are kept, the rest is paired up by
+// kind as changed, anything left over was added/removed. Call before the old
+// list is freed (assets taken over compare by pointer).
+static void dl_diff(const DisplayList *O, const DisplayList *N){
+    uint8_t *used=(uint8_t*)calloc(O->n?O->n:1,1); if(!used) die("calloc diff");
+    int kept=0, only_old[4]={0}, only_new[4]={0};
+    for(int i=0;i<N->n;i++){
+        int k=0; while(k<O->n && (used[k] || !dl_op_same(&O->op[k],&N->op[i]))) k++;
+        if(k<O->n){ used[k]=1; kept++; } else only_new[N->op[i].kind]++;
+    }
+    for(int k=0;k<O->n;k++) if(!used[k]) only_old[O->op[k].kind]++;
+    int changed=0, added=0, removed=0;
+    for(int t=0;t<4;t++){
+        int c=only_old[t]<only_new[t]?only_old[t]:only_new[t];
+        changed+=c; added+=only_new[t]-c; removed+=only_old[t]-c;
+    }
+    int reused=0;
+    for(int i=0;i<O->n_assets;i++) if(!O->assets[i]) reused++;
+    fprintf(stderr,"[reload] %d ops: %d unchanged, %d changed, %d added, %d removed; %d of %d assets kept\n",
+            N->n, kept, changed, added, removed, reused, N->n_assets);
+    free(used);
+}
+
+// Memory report --------------------------------------------------------------------
+// Totals once the first frame has all its assets (per-item lines with debug=1), everything on
+// SIGUSR1. Asset bytes are what is resident right now (an evicted asset shows
+// only its RLE copy, if any).
+static void memory_report(const DisplayList *D, size_t fb_bytes, size_t out_bytes, int verbose){
+    char s1[16], s2[16]; size_t fonts=0;
+    pthread_mutex_lock(&g_am.mu);
+    for(int i=0;i<D->n_assets && verbose;i++){
+        const Asset *a = D->assets[i];
+        static const char *st_names[]={"unloaded","queued","ready","evicting","evicted","failed"};
+        size_t copy = (a->store==STORE_RAW)? a->rle.bytes : 0;
+        if(a->bytes) fmt_bytes_short(a->bytes,s1); else strcpy(s1,"-");
+        if(copy) fmt_bytes_short(copy,s2); else strcpy(s2,"-");
+        fprintf(stderr,"[mem] asset %-8s %-6s %7s  rle copy %7s  %s\n", st_names[a->state], store_name(a->store), s1, s2, a->path);
+    }
+    size_t resident=g_am.resident, cached=g_am.cached, scratch=g_am.scratch_cap;
+    pthread_mutex_unlock(&g_am.mu);
+    for(int i=0;i<g_n_ttf;i++){
+        size_t fb_=g_ttf_cache[i]->ttf_size+g_ttf_cache[i]->glyph_bytes; fonts+=fb_; fmt_bytes_short(fb_,s1);
+        if(verbose) fprintf(stderr,"[mem] font  %7s  %s @%dpx\n", s1, g_ttf_cache[i]->path, g_ttf_cache[i]->px);
+    }
+    size_t lc=0; // layer caches: rotated sprites, shapes, marquee strips and windows
+    for(int i=0;i<D->n;i++){ const DrawOp *o=&D->op[i]; lc+=o->rc.bytes+(size_t)o->spr_w*o->spr_h*4+(o->mq.strip? (size_t)o->mq.w*o->mq.h : 0)+(o->mq.win? (size_t)o->scroll_w*o->mq.h : 0); }
+    size_t bufs=fb_bytes+out_bytes+scratch+lc;
+    if(verbose) fprintf(stderr,"[mem] buffers: fb %zu KiB, rgb565 %zu KiB, rle scratch %zu KiB, layer caches %zu KiB\n", fb_bytes/1024, out_bytes/1024, scratch/1024, lc/1024);
+    fmt_bytes_short(resident+cached+fonts+bufs,s1); fmt_bytes_short(g_am.budget,s2);
+    fprintf(stderr,"[mem] total %s: assets %zu KiB + rle copies %zu KiB + fonts %zu KiB + buffers %zu KiB; budget %s\n",
+            s1, resident/1024, cached/1024, fonts/1024, bufs/1024, g_am.budget? s2 : "unlimited");
+}
+
+// Stats export -------------------------------------------------------------------
+// Prometheus text format for node_exporter's textfile collector, written to
+// <path>.tmp and renamed (the collector only reads *.prom, so it never sees a
+// half-written file).
+static void prom_counter(FILE *f, const char *name, const char *help, uint64_t v){
+    fprintf(f,"# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, (unsigned long long)v);
+}
+static void prom_gauge(FILE *f, const char *name, const char *help, double v){
+    fprintf(f,"# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, v);
+}
+// Quantiles, sum and count of one window; labels is "k=\"v\"" or NULL
+static void prom_summary(FILE *f, const char *name, const char *labels, const StatWin *w){
+    StatWin c=*w; uint32_t q[4]; size_t n=win_sorted(&c,q);
+    static const char *const qn[3]={ "0.5", "0.9", "0.99" };
+    const char *sep=labels? "," : "", *lb=labels? labels : "";
+    for(int i=0;i<3 && n;i++) fprintf(f,"%s{%s%squantile=\"%s\"} %.6f\n", name, lb, sep, qn[i], q[i]/1e6);
+    if(labels){ fprintf(f,"%s_sum{%s} %.6f\n%s_count{%s} %llu\n", name, lb, w->sum/1e6, name, lb, (unsigned long long)w->n); }
+    else fprintf(f,"%s_sum %.6f\n%s_count %llu\n", name, w->sum/1e6, name, (unsigned long long)w->n);
+}
+static int stats_write(const char *path, const char *wire, int fps_target, size_t fb_bytes, size_t out_bytes){
+    uint64_t now=now_monotonic_ms();
+    uint64_t sent=STAT_GET(sent);
+    if(g_stats.fps_ms && now>g_stats.fps_ms) g_stats.fps=(double)(sent-g_stats.fps_sent)*1000.0/(double)(now-g_stats.fps_ms);
+    g_stats.fps_sent=sent; g_stats.fps_ms=now;
+
+    char tmp[600]; snprintf(tmp,sizeof tmp,"%s.tmp",path);
+    FILE *f=fopen(tmp,"w");
+    if(!f){ fprintf(stderr,"stats %s: %s\n", tmp, strerror(errno)); return -1; }
+    fprintf(f,"# HELP trlcd_info Active device profile and wire format.\n# TYPE trlcd_info gauge\n");
+    fprintf(f,"trlcd_info{device=\"%s\",size=\"%dx%d\",wire=\"%s\"} 1\n", g_dev.name, W, H, wire);
+    prom_gauge(f,"trlcd_start_time_seconds","Unix time the daemon started.",(double)g_stats.started);
+    prom_counter(f,"trlcd_frames_rendered_total","Frames composed.",g_stats.rendered);
+    prom_counter(f,"trlcd_frames_reused_total","Frames where nothing visible changed; the previous one was sent again.",g_stats.reused);
+    prom_counter(f,"trlcd_frames_sent_total","Frames sent to the panel.",sent);
+    prom_counter(f,"trlcd_frames_skipped_total","Frames composed but not sent.",g_stats.skipped);
+    prom_gauge(f,"trlcd_fps","Frames sent per second since the previous export.",g_stats.fps);
+    prom_gauge(f,"trlcd_fps_target","Configured fps (0 = single frame).",fps_target);
+    prom_counter(f,"trlcd_usb_bytes_total","Bytes written to the OUT endpoint.",STAT_GET(usb_bytes));
+    prom_counter(f,"trlcd_usb_retries_total","Packet transfers retried.",STAT_GET(usb_retries));
+    prom_counter(f,"trlcd_usb_clear_halts_total","Endpoint halts cleared after a failed transfer.",STAT_GET(usb_clear_halts));
+    prom_counter(f,"trlcd_usb_resets_total","USB device resets after a failed transfer.",STAT_GET(usb_resets));
+    prom_counter(f,"trlcd_usb_reopens_total","Full libusb reopens after a failed transfer.",STAT_GET(usb_reopens));
+    prom_counter(f,"trlcd_usb_failures_total","Packets that could not be sent after all retries.",STAT_GET(usb_failures));
+
+    StatWin stage[N_STAGES], interval, jitter, present;
+    pthread_mutex_lock(&g_stats.mu);
+    memcpy(stage,g_stats.stage,sizeof stage); interval=g_stats.interval; jitter=g_stats.jitter; present=g_stats.present;
+    pthread_mutex_unlock(&g_stats.mu);
+    fprintf(f,"# HELP trlcd_stage_seconds Time per frame spent in each stage (quantiles over the last %d frames).\n# TYPE trlcd_stage_seconds summary\n", STAT_WINDOW);
+    for(int st=0;st<N_STAGES;st++){ char lb[48]; snprintf(lb,sizeof lb,"stage=\"%s\"",g_stage_names[st]); prom_summary(f,"trlcd_stage_seconds",lb,&stage[st]); }
+    uint32_t q[4];
+    fprintf(f,"# HELP trlcd_frame_interval_seconds Time between completed sends (quantiles over the last %d frames).\n# TYPE trlcd_frame_interval_seconds summary\n", STAT_WINDOW);
+    prom_summary(f,"trlcd_frame_interval_seconds",NULL,&interval);
+    win_sorted(&interval,q); prom_gauge(f,"trlcd_frame_interval_max_seconds","Longest interval in the window.",q[3]/1e6);
+    fprintf(f,"# HELP trlcd_tx_jitter_seconds Deviation of the send interval from the frame period (quantiles over the last %d frames).\n# TYPE trlcd_tx_jitter_seconds summary\n", STAT_WINDOW);
+    prom_summary(f,"trlcd_tx_jitter_seconds",NULL,&jitter);
+    win_sorted(&jitter,q); prom_gauge(f,"trlcd_tx_jitter_max_seconds","Largest deviation in the window.",q[3]/1e6);
+    fprintf(f,"# HELP trlcd_apng_present_error_seconds From when a new APNG frame was due to when the frame showing it was on the panel (quantiles over the last %d such frames).\n# TYPE trlcd_apng_present_error_seconds summary\n", STAT_WINDOW);
+    prom_summary(f,"trlcd_apng_present_error_seconds",NULL,&present);
+    win_sorted(&present,q); prom_gauge(f,"trlcd_apng_present_error_max_seconds","Largest presentation error in the window.",q[3]/1e6);
+    prom_counter(f,"trlcd_apng_frames_dropped_total","APNG frames whose whole display time passed between two sent frames.",g_stats.apng_dropped);
+    fprintf(f,"# HELP trlcd_tx_page_faults_total Page faults taken by the transmit thread.\n# TYPE trlcd_tx_page_faults_total counter\n");
+    fprintf(f,"trlcd_tx_page_faults_total{kind=\"minor\"} %llu\ntrlcd_tx_page_faults_total{kind=\"major\"} %llu\n", (unsigned long long)STAT_GET(tx_minflt), (unsigned long long)STAT_GET(tx_majflt));
+    fprintf(f,"# HELP trlcd_tx_sched_info Transmit thread settings.\n# TYPE trlcd_tx_sched_info gauge\n");
+    fprintf(f,"trlcd_tx_sched_info{policy=\"%s\",priority=\"%d\",cpu=\"%d\"} 1\n", tx_sched_name(g_tx.sched), g_tx.sched? g_tx.prio : 0, g_tx.cpu);
+    prom_gauge(f,"trlcd_tx_locked_bytes","Transmit stack and buffers locked in RAM (tx_mlock).",(double)g_tx.locked);
+
+    pthread_mutex_lock(&g_am.mu);
+    size_t resident=g_am.resident, cached=g_am.cached, scratch=g_am.scratch_cap, budget=g_am.budget;
+    pthread_mutex_unlock(&g_am.mu);
+    size_t fonts=0; for(int i=0;i<g_n_ttf;i++) fonts+=g_ttf_cache[i]->ttf_size+g_ttf_cache[i]->glyph_bytes;
+    fprintf(f,"# HELP trlcd_memory_bytes Decoded assets, their RLE copies, font files and frame buffers.\n# TYPE trlcd_memory_bytes gauge\n");
+    fprintf(f,"trlcd_memory_bytes{kind=\"assets\"} %zu\ntrlcd_memory_bytes{kind=\"rle_copies\"} %zu\n", resident, cached);
+    fprintf(f,"trlcd_memory_bytes{kind=\"fonts\"} %zu\ntrlcd_memory_bytes{kind=\"buffers\"} %zu\n", fonts, fb_bytes+out_bytes+scratch);
+    prom_gauge(f,"trlcd_memory_budget_bytes","memory_budget_mb in bytes (0 = unlimited).",(double)budget);
+
+    int rc = ferror(f)? -1 : 0;
+    if(fflush(f)!=0 || fsync(fileno(f))!=0) rc=-1;
+    if(fclose(f)!=0) rc=-1;
+    if(!rc && rename(tmp,path)!=0) rc=-1;
+    if(rc){ fprintf(stderr,"stats %s: %s\n", path, strerror(errno)); unlink(tmp); }
+    return rc;
+}
+
+// debug=1: the pacing windows once per stats_interval_s, next to the stages and
+// retries, to tell rendering, USB and scheduling stalls apart
+static void pacing_report(int period_ms){
+    StatWin iv, pr, dr, en, se;
+    pthread_mutex_lock(&g_stats.mu);
+    iv=g_stats.interval; pr=g_stats.present; dr=g_stats.stage[ST_DRAW]; en=g_stats.stage[ST_ENCODE]; se=g_stats.stage[ST_SEND];
+    pthread_mutex_unlock(&g_stats.mu);
+    uint32_t qi[4], qp[4], qd[4], qe[4], qs[4];
+    win_sorted(&iv,qi); size_t np=win_sorted(&pr,qp); win_sorted(&dr,qd); win_sorted(&en,qe); win_sorted(&se,qs);
+    static uint64_t last_dropped, last_retries;
+    uint64_t retries=STAT_GET(usb_retries);
+    fprintf(stderr,"[pacing] interval p50/p99/max %.1f/%.1f/%.1f ms (target %d)", qi[0]/1e3, qi[2]/1e3, qi[3]/1e3, period_ms);
+    if(np) fprintf(stderr,", apng late p50/p99/max %.1f/%.1f/%.1f ms, %llu frames dropped", qp[0]/1e3, qp[2]/1e3, qp[3]/1e3, (unsigned long long)(g_stats.apng_dropped-last_dropped));
+    fprintf(stderr,"; p99 draw %.1f encode %.1f send %.1f ms, %llu usb retries\n", qd[2]/1e3, qe[2]/1e3, qs[2]/1e3, (unsigned long long)(retries-last_retries));
+    last_dropped=g_stats.apng_dropped; last_retries=retries;
+}
+
+// Layout analyzer (--analyze) ---------------------------------------------------
+// Loads layout.cfg and every asset, then renders the display list headless (no
+// USB) for a while on each page with the animation clock stepped at the target
+// frame rate. Prints decoded size per asset, pixels/glyphs/time per layer,
+// overdraw, the metric tokens the layout uses and the per-stage split of a
+// frame, so a layout that can't hold its fps shows before it is deployed.
+// Exit code 2 if some page misses the fps target.
+static const char *const g_metric_tokens[]={ "CPU_TEMP","CPU_USAGE","MEM_USED","MEM_FREE","GPU_TEMP","GPU_USAGE","TIME","DATE","CLOCK_H","CLOCK_M","CLOCK_S" };
+#define N_METRIC_TOKENS (int)(sizeof g_metric_tokens/sizeof g_metric_tokens[0])
+static unsigned metric_tokens_in(const char *s){
+    unsigned m=0; char pat[32];
+    for(int i=0;s && i<N_METRIC_TOKENS;i++){ snprintf(pat,sizeof pat,"%%%s%%",g_metric_tokens[i]); if(strcasestr(s,pat)) m|=1u<<i; }
+    return m;
+}
+static void op_label(const DrawOp *o, const Layout *L, char *out, size_t n){
+    switch(o->kind){
+    case OP_BG:   snprintf(out,n,"background %.100s", L->background_png); break;
+    case OP_IMG:  snprintf(out,n,"image %s", L->imgs[o->layer].path); break;
+    case OP_RECT: { const Overlay *v=&L->overlays[o->layer]; snprintf(out,n,"overlay %d,%d %dx%d", v->x,v->y,v->w,v->h); break; }
+    case OP_TEXT: snprintf(out,n,"text \"%.24s\"", L->texts[o->layer].text? L->texts[o->layer].text : ""); break;
+    }
+    for(char *c=out;*c;c++) if(*c=='\n') *c=' ';
+}
+static double ms_of(uint64_t us, int n){ return n? us/1000.0/n : 0.0; }
+static int analyze_layout(const Layout *L){
+    compute_fb(L);
+    int fbw=FBW, fbh=FBH; size_t fb_bytes=(size_t)fbw*fbh*4;
+    int jpeg = L->wire_format==WIRE_JPEG && L->wire_fmt>=0 && L->wire_fmt<=255 && L->wire_fmt!=(int)g_dev.pix;
+    int frame_ms = L->fps>0? 1000/L->fps : 0;
+    int nframes = L->fps>0? (L->fps*2<30? 30 : L->fps*2>240? 240 : L->fps*2) : 30;
+
+    asset_mgr_start((size_t)L->memory_budget_mb*1024*1024, 0);
+    DisplayList D; dl_build(&D,L,fbw,fbh,NULL);
+    uint64_t t=now_monotonic_us();
+    for(int i=0;i<D.n_assets;i++) asset_acquire(D.assets[i],0);
+    asset_wait_idle();
+    uint64_t load_us=now_monotonic_us()-t;
+
+    printf("layout.cfg on %s %dx%d, FB %dx%d, %s, %d draw ops\n", g_dev.name, W, H, fbw, fbh,
+           L->fps>0? "continuous" : "single frame", D.n);
+    if(L->fps>0) printf("target %d fps (%d ms per frame)\n", L->fps, frame_ms);
+    printf("\nassets (loaded in %.0f ms):\n", load_us/1000.0);
+    size_t dec_total=0, held_total=0; char s1[16], s2[16];
+    for(int i=0;i<D.n_assets;i++){
+        const Asset *a=D.assets[i];
+        if(a->state!=AS_READY){ printf("  %-52s failed to load\n", a->path); continue; }
+        unsigned nf = a->is_anim? a->anim.num_frames : 1;
+        int w = a->is_anim? (int)a->anim.canvas_w : a->stat.w, h = a->is_anim? (int)a->anim.canvas_h : a->stat.h;
+        size_t dec=asset_raw_bytes(a), held=a->bytes + (a->store==STORE_RAW? a->rle.bytes : 0);
+        dec_total+=dec; held_total+=held;
+        fmt_bytes_short(dec,s1); fmt_bytes_short(held,s2);
+        printf("  %-40s %4dx%-4d x%4u frames  decoded %7s  held %7s (%s)\n", a->path, w, h, nf, s1, s2, store_name(a->store));
+    }
+    fmt_bytes_short(dec_total,s1); fmt_bytes_short(held_total,s2);
+    printf("  total decoded %s, held %s%s\n", s1, s2, L->memory_budget_mb? "" : " (no memory_budget_mb)");
+
+    Metrics M; metrics_init(&M);
+    t=now_monotonic_us(); update_metrics(&M,1); uint64_t first_metrics_us=now_monotonic_us()-t;
+    unsigned used=0;
+    for(int i=0;i<L->n_texts;i++) used|=metric_tokens_in(L->texts[i].text)|metric_tokens_in(L->texts[i].visible_if);
+    for(int i=0;i<L->n_imgs;i++) used|=metric_tokens_in(L->imgs[i].visible_if)|metric_tokens_in(L->imgs[i].frame_from)|metric_tokens_in(L->imgs[i].rotate_from);
+    for(int i=0;i<L->n_overlays;i++) used|=metric_tokens_in(L->overlays[i].visible_if);
+    for(int i=0;i<L->n_pages;i++) used|=metric_tokens_in(L->pages[i].visible_if);
+    printf("\nmetrics used:");
+    for(int i=0;i<N_METRIC_TOKENS;i++) if(used&(1u<<i)){ double v; printf(" %s%s", g_metric_tokens[i], metric_value(&M,g_metric_tokens[i],&v)==0? "" : "(n/a)"); }
+    printf("%s; every collector is sampled each frame (first sample %.1f ms)\n", used? "" : " none", first_metrics_us/1000.0);
+
+    uint8_t *fb=fb_rgba_alloc_clear(fbw,fbh);
+    uint8_t *rgb565=(uint8_t*)malloc(FRAME_LEN); if(!rgb565) die("malloc565");
+    uint8_t *rgb888=NULL; ByteVec jpg; bv_init(&jpg); JpgTables jt;
+    if(jpeg){ jpg_tables_init(&jt,L->jpeg_quality); rgb888=(uint8_t*)malloc((size_t)W*H*3); if(!rgb888) die("malloc rgb888"); }
+    OpStats *st=(OpStats*)calloc(D.n?D.n:1,sizeof(OpStats)); if(!st) die("calloc stats");
+    int miss=0, frame=0;
+    for(int p=(L->n_pages?0:-1); p<L->n_pages; p++){
+        memset(st,0,(D.n?D.n:1)*sizeof(OpStats));
+        uint64_t us_metrics=0, us_clear=0, us_draw=0, us_pack=0, us_jpeg=0;
+        for(int f=0;f<nframes;f++,frame++){
+            uint64_t t0=now_monotonic_ms() - (uint64_t)f*(frame_ms?frame_ms:33); // playback clock f frames in
+            uint64_t a=now_monotonic_us(); update_metrics(&M,0);
+            uint64_t b=now_monotonic_us(); dl_clear(&D,fb,fbw,fbh);
+            uint64_t c=now_monotonic_us(); dl_resolve(&D,p,&M,frame,t0); dl_draw(&D,fb,fbw,fbh,st);
+            uint64_t d=now_monotonic_us();
+            int vx,vy; compute_viewport(L,&vx,&vy); viewport_to_rgb565(fb,fbw,fbh,vx,vy,rgb565);
+            uint64_t e=now_monotonic_us();
+            if(jpeg){ viewport_to_rgb888(fb,fbw,fbh,vx,vy,rgb888); jpeg_encode_rgb(&jpg,rgb888,W,H,&jt); }
+            uint64_t g=now_monotonic_us();
+            us_metrics+=b-a; us_clear+=c-b; us_draw+=d-c; us_pack+=e-d; us_jpeg+=g-e;
+        }
+        if(L->n_pages) printf("\npage %s (%d frames):\n", L->pages[p].name, nframes);
+        else printf("\nlayers (%d frames):\n", nframes);
+        uint64_t px_total=0, glyphs=0; int worst=-1;
+        printf("  %-46s %9s %9s %7s %8s\n", "layer", "px/frame", "% of FB", "glyphs", "ms/frame");
+        for(int i=0;i<D.n;i++){
+            if(!st[i].frames) continue;
+            char lab[128]; op_label(&D.op[i],L,lab,sizeof lab);
+            double px=(double)st[i].px/st[i].frames;
+            px_total+=st[i].px/st[i].frames; glyphs+=st[i].glyphs/st[i].frames;
+            if(worst<0 || st[i].us>st[worst].us) worst=i;
+            printf("  %-46.46s %9.0f %8.1f%% %7.1f %8.3f%s\n", lab, px, 100.0*px/((double)fbw*fbh),
+                   (double)st[i].glyphs/st[i].frames, ms_of(st[i].us,(int)st[i].frames), st[i].frames<(uint64_t)nframes? " (part of the time)" : "");
+        }
+        double total_ms = ms_of(us_metrics+us_clear+us_draw+us_pack+us_jpeg, nframes);
+        printf("  overdraw %.2fx of the FB, %llu glyphs drawn per frame\n", (double)px_total/((double)fbw*fbh), (unsigned long long)glyphs);
+        printf("  stages ms/frame: metrics %.3f, clear %.3f, draw %.3f, rgb565 %.3f", ms_of(us_metrics,nframes), ms_of(us_clear,nframes), ms_of(us_draw,nframes), ms_of(us_pack,nframes));
+        if(jpeg) printf(", jpeg %.3f (%zu bytes)", ms_of(us_jpeg,nframes), jpg.size);
+        printf(" = %.3f ms + USB transfer (not measured)\n", total_ms);
+        if(L->fps>0){
+            if(total_ms>frame_ms){ miss=1; printf("  MISSES %d fps: %.1f ms per frame before USB", L->fps, total_ms); }
+            else printf("  fits %d fps: %.0f%% of the frame before USB", L->fps, 100.0*total_ms/frame_ms);
+            if(worst>=0){ char lab[128]; op_label(&D.op[worst],L,lab,sizeof lab); printf("; costliest layer %s", lab); }
+            printf("\n");
+        }
+    }
+    printf("\n"); fflush(stdout);
+    memory_report(&D,fb_bytes,FRAME_LEN,1);
+
+    free(st); free(fb); free(rgb565); free(rgb888); bv_free(&jpg);
+    asset_mgr_stop();
+    dl_free(&D);
+    ttf_free_all(); sensors_close();
+    return miss? 2 : 0;
 }
 
 // Main ---------------------------------------------------------------------------
-int main(void){
+int main(int argc, char **argv){
+    int analyze=0;
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--analyze")) analyze=1;
+        else { fprintf(stderr,"usage: %s [--analyze]\n", argv[0]); return 1; }
+    }
+    startup_begin();
     struct sigaction sa = {0};
     sa.sa_handler = on_sighup;  sigaction(SIGHUP,  &sa, NULL);
     sa.sa_handler = on_sigterm; sigaction(SIGTERM, &sa, NULL);
     sa.sa_handler = on_sigterm; sigaction(SIGINT,  &sa, NULL);
+    sa.sa_handler = on_sigusr1; sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = on_sigusr2; sigaction(SIGUSR2, &sa, NULL);
 
     Layout L;
     if(load_layout("layout.cfg",&L)!=0){ fprintf(stderr,"Failed to load layout.cfg\n"); return 1; }
-
-    // Compute FB and viewport
-    int FBW_local, FBH_local;
-    compute_fb(&L);
-    FBW_local = (W * L.fb_scale_percent + 99) / 100;
-    FBH_local = (H * L.fb_scale_percent + 99) / 100;
-    int fbw=FBW_local, fbh=FBH_local;
-
-    // Preload background as asset
-    Asset bg={0};
-    // Try APNG precompose (rotate all frames at load if background_flip)
-    int apng_stat = apng_load_precompose(L.background_png, &bg.anim, L.background_flip);
-    if(apng_stat==0 && bg.anim.is_apng){
-        bg.is_anim=1; bg.loaded=1;
-        bg.speed = L.bg_apng_speed; bg.start_ms = L.bg_apng_start_ms;
-        bg.loop_mode = L.bg_apng_loop_mode; bg.loop_N = L.bg_apng_loop_N;
-        fprintf(stderr,"[APNG] background: %u frames, plays=%u, total=%ums (%s)\n",
-                bg.anim.num_frames, bg.anim.plays, bg.anim.total_ms, L.background_png);
-    } else if(apng_stat==1){
-        // Static PNG fallback
-        ImageRGBA s = load_png_rgba_stb(L.background_png);
-        if(L.background_flip) rotate180_rgba(s.rgba, s.w, s.h);
-        bg.is_anim=0; bg.stat=s; bg.loaded=1;
-    } else {
-        fprintf(stderr,"Failed to load background: %s\n", L.background_png);
-        return 1;
-    }
-
-    // Preload image layers
-    Asset *imgA=(Asset*)calloc(L.n_imgs,sizeof(Asset));
-    for(int i=0;i<L.n_imgs;i++){
-        ApngAnim anim={0};
-        int st = apng_load_precompose(L.imgs[i].path, &anim, 0);
-        if(st==0 && anim.is_apng){
-            imgA[i].is_anim=1; imgA[i].anim=anim; imgA[i].loaded=1;
-            imgA[i].speed=L.imgs[i].apng_speed; imgA[i].start_ms=L.imgs[i].apng_start_ms;
-            imgA[i].loop_mode=L.imgs[i].apng_loop_mode; imgA[i].loop_N=L.imgs[i].apng_loop_N;
-            fprintf(stderr,"[APNG] image[%d]: %u frames, plays=%u, total=%ums (%s)\n",
-                    i, anim.num_frames, anim.plays, anim.total_ms, L.imgs[i].path);
-        } else if(st==1){
-            ImageRGBA s = load_png_rgba_stb(L.imgs[i].path);
-            imgA[i].is_anim=0; imgA[i].stat=s; imgA[i].loaded=1;
-        } else {
-            fprintf(stderr,"Failed to load image layer: %s\n", L.imgs[i].path);
-            imgA[i].loaded=0;
-        }
-    }
+    layout_check_conditions(&L);
+    g_timeline=L.debug && !analyze;
+    { struct timespec bt; if(clock_gettime(CLOCK_BOOTTIME,&bt)==0) startup_mark("layout loaded (%lld ms since boot)", (long long)bt.tv_sec*1000+bt.tv_nsec/1000000); }
 
     // USB open
     libusb_context* ctx=NULL; libusb_device_handle* h=NULL;
     if(libusb_init(&ctx)){ fprintf(stderr,"libusb_init failed\n"); return 1; }
+    if(select_profile(ctx,&L)!=0){ libusb_exit(ctx); return 1; }
+    if(L.debug) fprintf(stderr,"[device] %s %04x:%04x %dx%d packet=%d\n", g_dev.name, VID, PID, W, H, PACK);
+    g_sensors.want_uring=L.metrics_uring;
+    if(analyze){ g_timeline=0; int rc=analyze_layout(&L); libusb_exit(ctx); layout_free(&L); return rc; }
+    if(L.trace_frames>0) trace_start(L.trace_frames);
     h=libusb_open_device_with_vid_pid(ctx,VID,PID);
     if(!h){ fprintf(stderr,"device %04x:%04x not found\n",VID,PID); libusb_exit(ctx); return 1; }
     libusb_set_auto_detach_kernel_driver(h,1);
@@ -1219,80 +4015,152 @@ int main(void){
         fprintf(stderr,"No OUT endpoint%s\n",(L.iface!=-1?" on requested iface":"")); libusb_close(h); libusb_exit(ctx); return 1;
     }
     ensure_claim(h,iface);
-    uint16_t wIndex=(uint16_t)iface;
-    uint8_t hdr[PACK]; build_header_fixed(hdr);
+    startup_mark("usb open");
+
+    // Compute FB and viewport
+    compute_fb(&L);
+    int fbw=FBW, fbh=FBH;
+
+    if(L.wire_format==WIRE_PROBE){
+        int rc=wire_probe(&ctx,&h,L.iface,&iface,&ep_out,&L);
+        if(h && iface>=0) libusb_release_interface(h,iface);
+        if(h) libusb_close(h); if(ctx) libusb_exit(ctx);
+        layout_free(&L);
+        return rc?1:0;
+    }
+    if(L.wire_format==WIRE_JPEG && (L.wire_fmt<0 || L.wire_fmt>255 || L.wire_fmt==(int)g_dev.pix)){
+        fprintf(stderr,"wire_format=jpeg needs wire_fmt=<n> for this panel (find it with wire_format=probe); sending RGB565\n");
+    }
+    int jpeg = L.wire_format==WIRE_JPEG && L.wire_fmt>=0 && L.wire_fmt<=255 && L.wire_fmt!=(int)g_dev.pix;
+
+    uint8_t hdr[PACK_MAX]; build_header(hdr,(uint8_t)g_dev.pix,FRAME_LEN);
+    uint8_t *rgb565=(uint8_t*)malloc(FRAME_LEN); if(!rgb565) die("malloc565");
+    // JPEG on the wire: frame_len changes per frame, RGB565 stays for snapshots
+    uint8_t hdr_jpg[PACK_MAX], *rgb888=NULL; ByteVec jpg; bv_init(&jpg); JpgTables jt;
+    if(jpeg){
+        jpg_tables_init(&jt,L.jpeg_quality);
+        rgb888=(uint8_t*)malloc((size_t)W*H*3); if(!rgb888) die("malloc rgb888");
+    }
+    // Previous run's last frame goes out before anything is decoded or sampled
+    uint64_t snap_hash=0, snap_ms=0, snap_hold=0; // snap_hold: nothing replaces it before then while loading
+    if(L.snapshot_path[0] && snapshot_load(L.snapshot_path,rgb565)==0){
+        if(send_frame(&ctx,&h,L.iface,&iface,&ep_out,hdr,rgb565,FRAME_LEN)==0){
+            snap_hash=fnv1a64(rgb565,FRAME_LEN); snap_ms=now_monotonic_ms();
+            if(L.snapshot_hold_ms>0) snap_hold=snap_ms+(uint64_t)L.snapshot_hold_ms;
+            startup_mark("snapshot sent (%s)", L.snapshot_path);
+        }
+    }
+
+    // Assets decode on the loader thread when first drawn (background included)
+    asset_mgr_start((size_t)L.memory_budget_mb*1024*1024, L.debug);
+    DisplayList D; dl_build(&D,&L,fbw,fbh,NULL);
+
     int period_ms=(L.fps>0)?(1000/L.fps):0;
 
     Metrics M; metrics_init(&M);
+    PageState ps={ -1, 0 }; int last_page=-2;
     int frame_idx=0;
     uint64_t t0 = now_monotonic_ms();
 
-    do{
-        uint8_t *fb = fb_rgba_alloc_clear(fbw, fbh);
-
+    // Frame buffers live for the whole run
+    size_t fb_bytes=(size_t)fbw*fbh*4;
+    uint8_t *fb = fb_rgba_alloc_clear(fbw, fbh);
+    int reported=0, last_complete=0;
+    uint64_t stats_ms=0, pacing_ms=0, last_key=0;
+    Transition tr; memset(&tr,0,sizeof tr);
+    const uint8_t *fh=hdr, *payload=rgb565; int plen=FRAME_LEN; // last encoded frame, sent again while nothing changes
+    g_stats.started=time(NULL); g_stats.fps_ms=now_monotonic_ms();
+    tx_start(&L,&ctx,&h,&iface,&ep_out); // owns the USB handle from here on
+
+    int exit_code=0;
+    for(;;){
+        if(g_trace_req){ g_trace_req=0; trace_start(L.trace_frames>0? L.trace_frames : 120); }
+        uint64_t t_frame=now_monotonic_us(), t_stage=t_frame;
+        PROBE1(frame_begin, frame_idx);
         // Update metrics (blocking sample on 1st frame if one-shot)
         update_metrics(&M, (frame_idx==0 && period_ms==0));
+        t_stage=stage_end(ST_METRICS,t_stage);
 
-        // Background position
-        int bgx=0,bgy=0;
-        if(bg.is_anim){
-            int bw=(int)bg.anim.canvas_w, bh=(int)bg.anim.canvas_h;
-            bgx = L.bg_x_mode ? (fbw - bw)/2 : L.bg_x;
-            bgy = L.bg_y_mode ? (fbh - bh)/2 : L.bg_y;
-            if(bgx<-bw) bgx=-bw; if(bgy<-bh) bgy=-bh; if(bgx>fbw) bgx=fbw; if(bgy>fbh) bgy=fbh;
-
-            uint64_t elapsed = now_monotonic_ms() - t0 + (uint64_t)(bg.start_ms>=0? bg.start_ms : 0);
-            unsigned rem_ms=0;
-            unsigned idx = apng_pick_frame(&bg.anim, elapsed, bg.speed, bg.loop_mode, bg.loop_N, &rem_ms);
-            const uint8_t *fr = bg.anim.frame_rgba[idx];
-            blit_png_into_fb(fb,fbw,fbh, fr, bw,bh, bgx,bgy, -1, 1.0f);
-        } else {
-            int bw=bg.stat.w, bh=bg.stat.h;
-            bgx = L.bg_x_mode ? (fbw - bw)/2 : L.bg_x;
-            bgy = L.bg_y_mode ? (fbh - bh)/2 : L.bg_y;
-            if(bgx<-bw) bgx=-bw; if(bgy<-bh) bgy=-bh; if(bgx>fbw) bgx=fbw; if(bgy>fbh) bgy=fbh;
-            blit_png_into_fb(fb,fbw,fbh, bg.stat.rgba, bw,bh, bgx,bgy, -1, 1.0f);
+        int page = pick_page(&L, &M, now_monotonic_ms(), &ps);
+        if(L.debug && L.n_pages && page!=last_page) fprintf(stderr,"[page] -> %s\n", page>=0?L.pages[page].name:"(none)");
+        int vx,vy; compute_viewport(&L,&vx,&vy);
+        if(page!=last_page && last_page!=-2 && last_complete){
+            const Page *pg = page>=0? &L.pages[page] : NULL;
+            tr_begin(&tr,&L, pg && pg->transition>=0? pg->transition : L.transition, pg && pg->transition_ms>=0? pg->transition_ms : L.transition_ms, fb,fbw,fbh,vx,vy);
         }
-
-        // Image layers
-        for(int i=0;i<L.n_imgs;i++){
-            if(!imgA[i].loaded) continue;
-            if(imgA[i].is_anim){
-                const ApngAnim *A=&imgA[i].anim;
-                uint64_t elapsed = now_monotonic_ms() - t0 + (uint64_t)(imgA[i].start_ms>=0? imgA[i].start_ms : 0);
-                unsigned rem_ms=0;
-                unsigned idx = apng_pick_frame(A, elapsed, imgA[i].speed, imgA[i].loop_mode, imgA[i].loop_N, &rem_ms);
-                const uint8_t *fr = A->frame_rgba[idx];
-                blit_png_into_fb(fb,fbw,fbh, fr, (int)A->canvas_w,(int)A->canvas_h, L.imgs[i].x, L.imgs[i].y, L.imgs[i].alpha, L.imgs[i].scale>0?L.imgs[i].scale:1.0f);
-            } else {
-                blit_png_into_fb(fb,fbw,fbh, imgA[i].stat.rgba, imgA[i].stat.w,imgA[i].stat.h, L.imgs[i].x, L.imgs[i].y, L.imgs[i].alpha, L.imgs[i].scale>0?L.imgs[i].scale:1.0f);
+        last_page=page;
+
+        // A running transition only blends its two cached frames
+        int waiting=0, reuse=0, trans = tr.kind && !tr.pending;
+        if(trans) g_apng_due_us=0; // no APNG frame is due on a transition frame
+        else {
+            waiting=dl_resolve(&D,page,&M,frame_idx,t0); // visible assets still loading
+            if(waiting<0){ fprintf(stderr,"Failed to load background: %s\n", L.background_png); exit_code=1; break; }
+            // Same picture as the last complete frame: skip drawing and encoding
+            reuse = !tr.pending && !waiting && last_complete && D.key==last_key;
+            last_key=D.key;
+            if(!reuse){
+                if(frame_idx || D.fill_row || D.fill_col) dl_clear(&D,fb,fbw,fbh);
+                dl_draw(&D,fb,fbw,fbh,NULL);
             }
+            if(tr.pending && !waiting){ tr_capture(&tr.to,fb,fbw,vx,vy); tr.pending=0; tr.t0=now_monotonic_ms(); }
+        }
+        if(tr.kind && !tr_render(&tr,fb,fbw,vx,vy,now_monotonic_ms())) last_key=0; // done: redraw the live page next
+        asset_enforce_budget(frame_idx);
+        if(reuse){ g_stats.reused++; t_stage=now_monotonic_us(); }
+        else { g_stats.rendered++; t_stage=stage_end(ST_DRAW,t_stage); }
+
+        // Single-shot: don't send placeholders, wait for the loader and redraw
+        // (the playback clock restarts so animations begin at their first frame)
+        if(waiting && !(period_ms>0 && L.once==0)){ g_stats.skipped++; asset_wait_idle(); t0=now_monotonic_ms(); frame_idx++; continue; }
+        // Continuous: the startup snapshot stays on the panel until the first
+        // complete frame (or snapshot_hold_ms) instead of a half-loaded one
+        int hold = snap_hold && waiting && now_monotonic_ms()<snap_hold;
+        if(!hold) snap_hold=0;
+
+        if(hold) g_stats.skipped++;
+        else if(!reuse){
+            // Viewport -> RGB565
+            viewport_to_rgb565(fb,fbw,fbh,vx,vy,rgb565);
+
+            fh=hdr; payload=rgb565; plen=FRAME_LEN;
+            if(jpeg){
+                viewport_to_rgb888(fb,fbw,fbh,vx,vy,rgb888);
+                jpeg_encode_rgb(&jpg,rgb888,W,H,&jt);
+                if(jpg.size<FRAME_LEN){ // never bigger than raw
+                    build_header(hdr_jpg,(uint8_t)L.wire_fmt,(uint32_t)jpg.size);
+                    fh=hdr_jpg; payload=jpg.data; plen=(int)jpg.size;
+                }
+                if(L.debug && !reported && !waiting) fprintf(stderr,"[wire] jpeg q=%d fmt=%d: %d bytes (%.1fx smaller than RGB565)\n", jt.quality, L.wire_fmt, plen, (double)FRAME_LEN/plen);
+            }
+            t_stage=stage_end(ST_ENCODE,t_stage);
         }
-
-        // Overlays
-        for(int i=0;i<L.n_overlays;i++) draw_overlay_ui(fb,fbw,fbh,L.overlays[i],L.text_orient,L.text_flip,&L);
-
-        // Text
-        for(int i=0;i<L.n_texts;i++) draw_text_ttf(fb,fbw,fbh,&L.texts[i],L.text_orient,L.text_flip,&L,&M);
-
-        // Viewport -> RGB565
-        int vx,vy; compute_viewport(&L,&vx,&vy);
-        uint8_t *rgb565 = viewport_to_rgb565(fb,fbw,fbh,vx,vy);
 
         // Send
-        ctrl_nudge(h,wIndex);
-        int rc=out512_retry(&ctx,&h,L.iface,&iface,&ep_out,hdr,sizeof hdr);
-        if(rc){ fprintf(stderr,"header send failed rc=%d\n",rc); free(rgb565); free(fb); break; }
-        ctrl_nudge(h,wIndex);
-        for(int off=0; off<FRAME_LEN; off+=PACK){
-            ctrl_nudge(h,wIndex);
-            int n=(FRAME_LEN-off>=PACK)?PACK:(FRAME_LEN-off);
-            rc=out512_retry(&ctx,&h,L.iface,&iface,&ep_out,rgb565+off,n);
-            if(rc){ fprintf(stderr,"data send failed at off=%d rc=%d\n",off,rc); free(rgb565); free(fb); goto tx_done; }
-            ctrl_nudge(h,wIndex);
+        if(!hold && tx_submit(fh,payload,plen,frame_idx,period_ms,g_apng_due_us)!=0){ exit_code=1; break; }
+        last_complete=!waiting;
+        stage_end(ST_FRAME,t_frame);
+        if(TRACE_ON() && --g_trace.frames_left<=0) trace_write(L.trace_path);
+        if(L.stats_path[0] && (!stats_ms || now_monotonic_ms()-stats_ms>=(uint64_t)(L.stats_interval_s>0?L.stats_interval_s:1)*1000)){
+            stats_write(L.stats_path,jpeg?"jpeg":"rgb565",L.fps,fb_bytes,FRAME_LEN); stats_ms=now_monotonic_ms();
+        }
+        if(L.debug && period_ms>0 && now_monotonic_ms()-pacing_ms>=(uint64_t)(L.stats_interval_s>0?L.stats_interval_s:1)*1000){
+            if(pacing_ms) pacing_report(period_ms);
+            pacing_ms=now_monotonic_ms();
         }
-        free(rgb565);
-        free(fb);
+
+        // Snapshot: after the first complete frame, then every snapshot_interval_s if it changed
+        if(L.snapshot_path[0] && !waiting){
+            uint64_t now=now_monotonic_ms();
+            if(!reported || (L.snapshot_interval_s>0 && now-snap_ms>=(uint64_t)L.snapshot_interval_s*1000)){
+                uint64_t hh=fnv1a64(rgb565,FRAME_LEN);
+                if(hh!=snap_hash && snapshot_save(L.snapshot_path,rgb565)==0) snap_hash=hh;
+                snap_ms=now;
+            }
+        }
+        if((frame_idx==0 && !hold) || (!reported && !waiting)) startup_mark(waiting? "first frame sent (%d assets loading)" : "first complete frame sent", waiting);
+        if(!reported && !waiting) g_timeline=0;
+        if((!reported && !waiting) || g_mem_report){ g_mem_report=0; memory_report(&D,fb_bytes,FRAME_LEN,L.debug||reported); reported=1; }
 
         if(period_ms>0){ struct timespec ts; ts.tv_sec=period_ms/1000; ts.tv_nsec=(long)(period_ms%1000)*1000000L; nanosleep(&ts,NULL); }
         frame_idx++;
@@ -1300,25 +4168,55 @@ int main(void){
         if (g_stop) break;
 
         if (g_reload) {
-           // will add when or if I want it, restarting the service is fine at the moment
             g_reload = 0;
+            Layout NL;
+            int bw,bh; // a missing background would only fail once swapped in, and end the run
+            if(load_layout("layout.cfg",&NL)!=0) fprintf(stderr,"[reload] failed to load layout.cfg; keeping the current layout\n");
+            else if(NL.background_png[0] && png_peek_size(NL.background_png,&bw,&bh)!=0){
+                fprintf(stderr,"[reload] background_png %s is not a readable PNG; keeping the current layout\n",NL.background_png);
+                layout_free(&NL);
+            }
+            else {
+                layout_check_conditions(&NL);
+                if(layout_keep_fixed(&NL,&L)) fprintf(stderr,"[reload] device, wire format, iface, memory_budget_mb and tx_* changes need a restart\n");
+                asset_wait_idle(); // assets only change hands while the loader is idle
+                if(last_complete){ int ox,oy; compute_viewport(&L,&ox,&oy); tr_begin(&tr,&NL,NL.transition,NL.transition_ms,fb,fbw,fbh,ox,oy); }
+                if(NL.fb_scale_percent!=L.fb_scale_percent){
+                    compute_fb(&NL); fbw=FBW; fbh=FBH; fb_bytes=(size_t)fbw*fbh*4;
+                    free(fb); fb=fb_rgba_alloc_clear(fbw,fbh);
+                }
+                DisplayList ND; dl_build(&ND,&NL,fbw,fbh,&D);
+                dl_diff(&D,&ND);
+                dl_free(&D); D=ND;
+                layout_free(&L); L=NL;
+                pthread_mutex_lock(&g_am.mu); g_am.debug=L.debug; pthread_mutex_unlock(&g_am.mu);
+                period_ms=(L.fps>0)?(1000/L.fps):0;
+                sensors_close(); g_sensors.want_uring=L.metrics_uring; // rescan (hotplugged hwmon/drm) on next sample
+                ps.cur=-1; last_page=-2; reported=0; last_key=0; // fresh memory report and snapshot once complete; redraw
+            }
         }
 
-    } while(period_ms>0 && L.once==0);
+        if(!(period_ms>0 && L.once==0)) break;
+    }
 
-tx_done:
+    if(tx_stop()!=0) exit_code=1; // the last frame is still going out
+    if(L.debug && period_ms>0) pacing_report(period_ms);
+    if(TRACE_ON()) trace_write(L.trace_path); // fewer frames than asked for
+    free(g_trace.ev);
+    if(L.stats_path[0]) stats_write(L.stats_path,jpeg?"jpeg":"rgb565",L.fps,fb_bytes,FRAME_LEN);
+    // Keep what is on the panel for the next start
+    if(L.snapshot_path[0] && last_complete && fnv1a64(rgb565,FRAME_LEN)!=snap_hash) snapshot_save(L.snapshot_path,rgb565);
+    free(rgb565); free(fb); free(rgb888); bv_free(&jpg); free(tr.from); free(tr.to);
     if(h && iface>=0) libusb_release_interface(h,iface);
     if(h) libusb_close(h); if(ctx) libusb_exit(ctx);
 
     // Free assets
-    if(bg.loaded) asset_free(&bg);
-    for(int i=0;i<L.n_imgs;i++) asset_free(&imgA[i]);
-    free(imgA);
+    asset_mgr_stop();
+    dl_free(&D);
+    ttf_free_all(); sensors_close();
 
-    for(int i=0;i<L.n_texts;i++){ free(L.texts[i].text); if(L.texts[i].ttf_path) free(L.texts[i].ttf_path); }
-    for(int i=0;i<L.n_imgs;i++) free(L.imgs[i].path);
-    free(L.texts); free(L.overlays); free(L.imgs);
+    layout_free(&L);
 
-    puts("Frame sent.");
-    return 0;
+    if(!exit_code) puts("Frame sent.");
+    return exit_code;
 }